@@ -1,29 +1,130 @@
 // main.cpp — "vimified" console IDE (Windows-only, no external libs)
 // Build: g++ -std=c++23 -Wall -Wextra -pedantic -O2 main.cpp -o text.exe
+// Check: text.exe --ab-tokenize <file>   (scanner vs std::regex tokenizer, JSON timings)
+// Perm:  text.exe --perm <len> <count|all> <file|-> [alphabet] [start]
+// Batch: text.exe --batch "tok stats" <file|@list>...   (JSON Lines, no console)
+// Perf:  add -DVIMIFIED_PERF for scoped timers (:perf, :perf trace)
+// Bench: g++ -std=c++23 -O2 -DVIMIFIED_BENCH main.cpp -o text-bench.exe
+//        text-bench.exe [--sizes 1M,100M,1G] [corpus files...]
 
 #include <windows.h>
 #include <conio.h>
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cctype>
+#include <charconv>
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <chrono>
 #include <fstream>
 #include <functional>
 #include <iostream>
 #include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <optional>
+#include <random>
 #include <regex>
 #include <set>
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 #include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// ============ profiling (-DVIMIFIED_PERF) ============
+// PERF_SCOPE("name") times the enclosing block with QueryPerformanceCounter
+// into a fixed ring of recent events; without VIMIFIED_PERF it expands to
+// nothing. Names must be string literals (only the pointer is stored).
+
+#ifdef VIMIFIED_PERF
+class PerfLog {
+public:
+    struct Event { const char* name; std::int64_t start, end; DWORD tid; };
+    static constexpr std::size_t CAPACITY = std::size_t(1) << 16;
+
+    static PerfLog& get(){ static PerfLog log; return log; }
+    static std::int64_t now(){ LARGE_INTEGER c; QueryPerformanceCounter(&c); return c.QuadPart; }
+    double us(std::int64_t ticks) const { return double(ticks) * 1e6 / double(freq_); }
+
+    void record(const char* name, std::int64_t t0, std::int64_t t1){
+        std::size_t i = next_.fetch_add(1, std::memory_order_relaxed);
+        ring_[i & (CAPACITY - 1)] = {name, t0, t1, GetCurrentThreadId()};
+    }
+    void reset(){ next_ = 0; }
+    // events still in the ring, oldest first
+    std::vector<Event> events() const {
+        std::size_t n = next_.load(std::memory_order_relaxed), k = std::min(n, CAPACITY);
+        std::vector<Event> out;
+        out.reserve(k);
+        for (std::size_t i = n - k; i < n; ++i) out.push_back(ring_[i & (CAPACITY - 1)]);
+        return out;
+    }
+    // one line per timer: count, p50, p99 and max in microseconds
+    std::vector<std::string> summary() const {
+        std::vector<std::pair<std::string_view, std::vector<double>>> by;
+        for (auto& e : events()) {
+            auto it = std::find_if(by.begin(), by.end(), [&](auto& b){ return b.first == e.name; });
+            if (it == by.end()) { by.emplace_back(e.name, std::vector<double>{}); it = by.end() - 1; }
+            it->second.push_back(us(e.end - e.start));
+        }
+        std::sort(by.begin(), by.end(), [](auto& a, auto& b){ return a.first < b.first; });
+        std::vector<std::string> out{"timer                      count      p50 us      p99 us      max us"};
+        for (auto& [name, v] : by) {
+            std::sort(v.begin(), v.end());
+            char line[160];
+            std::snprintf(line, sizeof(line), "%-24.24s %8zu %11.1f %11.1f %11.1f", std::string(name).c_str(), v.size(),
+                          v[v.size() / 2], v[std::min(v.size() - 1, v.size() * 99 / 100)], v.back());
+            out.emplace_back(line);
+        }
+        return out;
+    }
+    // Chrome trace-event JSON (chrome://tracing, Perfetto): complete events, ts/dur in us
+    template <class W> bool write_trace(W& w) const {
+        auto evs = events();
+        std::int64_t base = evs.empty() ? 0 : evs.front().start;
+        bool ok = w.write("{\"traceEvents\": [");
+        for (std::size_t i = 0; i < evs.size() && ok; ++i) {
+            char buf[256];
+            int n = std::snprintf(buf, sizeof(buf), "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %lu, \"ts\": %.3f, \"dur\": %.3f}",
+                                  i ? "," : "", evs[i].name, (unsigned long)evs[i].tid, us(evs[i].start - base), us(evs[i].end - evs[i].start));
+            ok = w.write(std::string_view(buf, (std::size_t)std::max(0, n)));
+        }
+        return ok && w.write("\n], \"displayTimeUnit\": \"ms\"}\n");
+    }
+
+private:
+    PerfLog(){ LARGE_INTEGER f; QueryPerformanceFrequency(&f); freq_ = f.QuadPart ? f.QuadPart : 1; }
+    std::int64_t freq_{1};
+    std::atomic<std::size_t> next_{0};
+    std::array<Event, CAPACITY> ring_{};
+};
+
+struct PerfScope {
+    const char* name;
+    std::int64_t t0{PerfLog::now()};
+    explicit PerfScope(const char* n): name(n) {}
+    ~PerfScope(){ PerfLog::get().record(name, t0, PerfLog::now()); }
+};
+#define PERF_CAT_(a, b) a##b
+#define PERF_CAT(a, b) PERF_CAT_(a, b)
+#define PERF_SCOPE(name) PerfScope PERF_CAT(perf_scope_, __LINE__){name}
+#else
+#define PERF_SCOPE(name) do {} while (0)
+#endif
 
 // ============ ANSI helpers ============
 
@@ -36,12 +137,21 @@ static void enable_vt() {
     SetConsoleMode(hOut, mode);
 }
 
-static void clear_screen() { std::cout << "\x1b[2J\x1b[H"; } // clear + home
-static void move_cursor(int row, int col) { std::cout << "\x1b[" << (row+1) << ";" << (col+1) << "H"; }
-static void invert_on() { std::cout << "\x1b[7m"; }
-static void invert_off(){ std::cout << "\x1b[0m"; }
+static void clear_screen(std::string& out) { out += "\x1b[2J\x1b[H"; } // clear + home
+static void move_cursor(std::string& out, int row, int col) {
+    char buf[32]; int n = std::snprintf(buf, sizeof(buf), "\x1b[%d;%dH", row+1, col+1);
+    out.append(buf, (std::size_t)n);
+}
+static void write_console(std::string_view s) {
+    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD written = 0;
+    if (hOut == INVALID_HANDLE_VALUE || !WriteFile(hOut, s.data(), (DWORD)s.size(), &written, nullptr)) {
+        std::cout.write(s.data(), (std::streamsize)s.size()); std::cout.flush();
+    }
+}
 
 static void get_console_size(int& rows, int& cols) {
+    PERF_SCOPE("get_console_size");
     CONSOLE_SCREEN_BUFFER_INFO info{};
     GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info);
     rows = info.srWindow.Bottom - info.srWindow.Top + 1;
@@ -50,6 +160,206 @@ static void get_console_size(int& rows, int& cols) {
     if (cols < 20) cols = 80;
 }
 
+// ============ screen (differential renderer) ============
+// Frames are composed into a back buffer of cells and compared with what the
+// terminal already shows; only changed runs are sent, as one write per frame.
+// A cell holds one UTF-8 code point (packed, up to 4 bytes) plus an attribute.
+
+class Screen {
+public:
+    enum Attr : std::uint8_t { NORMAL = 0, INVERSE = 1, KEYWORD, TYPE, STRING, COMMENT, NUMBER, PREPROC };
+
+    void resize(int rows, int cols){
+        if (rows == rows_ && cols == cols_) return;
+        rows_ = rows; cols_ = cols;
+        back_.assign((std::size_t)rows * (std::size_t)cols, Cell{});
+        invalidate();
+    }
+    // the next present() repaints everything (after resize or foreign output)
+    void invalidate(){ full_ = true; }
+    int rows() const { return rows_; }
+    int cols() const { return cols_; }
+
+    void clear(){ std::fill(back_.begin(), back_.end(), Cell{}); cur_row_ = cur_col_ = -1; }
+    // write s at (row, col), clipped to the row; control bytes show as blanks
+    void put(int row, int col, std::string_view s, std::uint8_t attr = NORMAL){
+        if (row < 0 || row >= rows_) return;
+        std::size_t i = 0;
+        while (i < s.size() && col < cols_) {
+            std::uint32_t g = decode_glyph(s, i);
+            if (col >= 0) back_[index(row, col)] = Cell{g, attr};
+            col++;
+        }
+    }
+    void fill(int row, int col, int n, std::uint8_t attr = NORMAL){
+        for (int c = std::max(col, 0); c < std::min(col + n, cols_); ++c) if (row >= 0 && row < rows_) back_[index(row, c)] = Cell{' ', attr};
+    }
+    // change the attribute of n cells, keeping their glyphs (search highlights)
+    void paint(int row, int col, int n, std::uint8_t attr){
+        if (row < 0 || row >= rows_) return;
+        for (int c = std::max(col, 0); c < std::min(col + n, cols_); ++c) back_[index(row, c)].attr = attr;
+    }
+    void set_cursor(int row, int col){ cur_row_ = row; cur_col_ = col; }
+
+    void present(){ write_console(render()); }
+    // the escape sequences that bring the console up to date with the back buffer
+    std::string_view render(){
+        out_.clear();
+        out_ += "\x1b[?25l";
+        if (full_ || front_.size() != back_.size()) {
+            // start from a blank terminal so only non-blank cells are sent
+            clear_screen(out_);
+            front_.assign(back_.size(), Cell{});
+            attr_ = NORMAL; full_ = false;
+        }
+        for (int r = 0; r < rows_; ++r) {
+            int c = 0;
+            while (c < cols_) {
+                if (back_[index(r, c)] == front_[index(r, c)]) { c++; continue; }
+                // extend the run across short unchanged gaps: re-sending a few
+                // cells is cheaper than another cursor-move sequence
+                int end = c + 1, gap = 0;
+                for (int k = c + 1; k < cols_ && gap < 4; ++k) {
+                    if (back_[index(r, k)] == front_[index(r, k)]) gap++;
+                    else { gap = 0; end = k + 1; }
+                }
+                move_cursor(out_, r, c);
+                for (; c < end; ++c) {
+                    const Cell& cell = back_[index(r, c)];
+                    if (cell.attr != attr_) { emit_attr(cell.attr); attr_ = cell.attr; }
+                    for (std::uint32_t g = cell.glyph; g; g >>= 8) out_.push_back((char)(g & 0xFF));
+                    front_[index(r, c)] = cell;
+                }
+            }
+        }
+        if (attr_ != NORMAL) { emit_attr(NORMAL); attr_ = NORMAL; }
+        if (cur_row_ >= 0 && cur_row_ < rows_ && cur_col_ >= 0 && cur_col_ < cols_) {
+            move_cursor(out_, cur_row_, cur_col_);
+            out_ += "\x1b[?25h";
+        }
+        return out_;
+    }
+
+private:
+    struct Cell {
+        std::uint32_t glyph{' '};
+        std::uint8_t attr{NORMAL};
+        bool operator==(const Cell&) const = default;
+    };
+    std::vector<Cell> back_, front_;
+    std::string out_;
+    int rows_{0}, cols_{0};
+    int cur_row_{-1}, cur_col_{-1};
+    std::uint8_t attr_{NORMAL};
+    bool full_{true};
+
+    std::size_t index(int r, int c) const { return (std::size_t)r * (std::size_t)cols_ + (std::size_t)c; }
+    void emit_attr(std::uint8_t a){
+        static constexpr const char* SGR[] = {"\x1b[0m", "\x1b[0;7m", "\x1b[0;94m", "\x1b[0;36m", "\x1b[0;33m", "\x1b[0;32m", "\x1b[0;35m", "\x1b[0;95m"};
+        out_ += SGR[a < std::size(SGR) ? a : 0];
+    }
+    // next code point of s starting at i, packed little-endian; malformed input shows as '?'
+    static std::uint32_t decode_glyph(std::string_view s, std::size_t& i){
+        unsigned char c = (unsigned char)s[i++];
+        if (c < 0x20 || c == 0x7F) return ' ';
+        if (c < 0x80) return c;
+        std::size_t n = (c >= 0xF0) ? 3 : (c >= 0xE0) ? 2 : (c >= 0xC0) ? 1 : 0;
+        if (!n || i + n > s.size()) return '?';
+        std::uint32_t g = c;
+        for (std::size_t k = 0; k < n; ++k) {
+            unsigned char cc = (unsigned char)s[i + k];
+            if ((cc & 0xC0) != 0x80) return '?';
+            g |= std::uint32_t(cc) << (8 * (k + 1));
+        }
+        i += n;
+        return g;
+    }
+};
+
+// ============ console input ============
+// Keys come from the console input queue as records rather than one
+// _getch() at a time, so everything already queued (a paste, key repeat)
+// is taken in one call. Records are translated to the codes _getch()
+// returns: the character, or 224 then the scan code for navigation keys.
+// Window resizes arrive in the same queue and are only flagged, so the
+// console size is queried once per resize instead of once per frame.
+// When stdin is not a console, conio is used as before.
+//
+// Background threads (job readers, search workers, the line indexer) set
+// wake_event() when they have something for the UI thread, so a busy but
+// idle editor sleeps in one wait on the console and that event.
+
+static HANDLE wake_event(){
+    static HANDLE ev = CreateEventA(nullptr, FALSE, FALSE, nullptr);   // auto-reset
+    return ev;
+}
+static void wake_ui(){ SetEvent(wake_event()); }
+
+class ConsoleInput {
+public:
+    ConsoleInput(){
+        DWORD mode = 0;
+        console_ = in_ != INVALID_HANDLE_VALUE && GetConsoleMode(in_, &mode);
+        if (console_) SetConsoleMode(in_, mode | ENABLE_WINDOW_INPUT);   // deliver WINDOW_BUFFER_SIZE_EVENT
+    }
+
+    // a key is queued (never blocks)
+    bool ready(){
+        if (!console_) return _kbhit() != 0;
+        pump();
+        return !keys_.empty();
+    }
+    // next key, waiting for one if necessary
+    int get(){
+        if (!console_) return _getch();
+        while (keys_.empty()) { WaitForSingleObject(in_, INFINITE); pump(); }
+        int k = keys_.front(); keys_.pop_front();
+        return k;
+    }
+    // without a console there are no resize events and the size must be polled
+    bool console() const { return console_; }
+    // block until the console has any input record; false without a console
+    bool wait(){ return console_ && WaitForSingleObject(in_, INFINITE) == WAIT_OBJECT_0; }
+    // block until there is console input, wake_event() is set, or ms pass;
+    // without a console keys cannot be waited for, so at most 15 ms
+    void wait_or_wake(DWORD ms){
+        if (!console_) { WaitForSingleObject(wake_event(), std::min<DWORD>(ms, 15)); return; }
+        HANDLE hs[2] = {in_, wake_event()};
+        WaitForMultipleObjects(2, hs, FALSE, ms);
+    }
+    // the window was resized since the last take_resize()
+    bool resized(){ if (console_) pump(); return resized_; }
+    bool take_resize(){ bool r = resized(); resized_ = false; return r; }
+
+private:
+    HANDLE in_{GetStdHandle(STD_INPUT_HANDLE)};
+    bool console_{false};
+    bool resized_{false};
+    std::deque<int> keys_;
+
+    // move every record the console holds right now into keys_
+    void pump(){
+        INPUT_RECORD rec[256];
+        DWORD n = 0, got = 0;
+        while (GetNumberOfConsoleInputEvents(in_, &n) && n && ReadConsoleInputA(in_, rec, std::min<DWORD>(n, 256), &got) && got)
+            for (DWORD i = 0; i < got; ++i) {
+                if (rec[i].EventType == KEY_EVENT) translate(rec[i].Event.KeyEvent);
+                else if (rec[i].EventType == WINDOW_BUFFER_SIZE_EVENT) resized_ = true;
+            }
+    }
+    void translate(const KEY_EVENT_RECORD& k){
+        if (!k.bKeyDown) return;
+        int code = (unsigned char)k.uChar.AsciiChar, ext = 0;
+        if (!code) switch (k.wVirtualKeyCode) {
+            case VK_UP: case VK_DOWN: case VK_LEFT: case VK_RIGHT:
+            case VK_HOME: case VK_END: case VK_PRIOR: case VK_NEXT: case VK_INSERT: case VK_DELETE:
+                code = 224; ext = k.wVirtualScanCode; break;
+            default: return;   // shift, ctrl, ... on their own
+        }
+        for (WORD r = 0; r < std::max<WORD>(k.wRepeatCount, 1); ++r) { keys_.push_back(code); if (ext) keys_.push_back(ext); }
+    }
+};
+
 // ============ file helpers ============
 static inline std::optional<std::string> read_text_file(const std::string& path) {
     std::ifstream ifs(path, std::ios::binary);
@@ -64,6 +374,145 @@ static inline bool write_text_file(const std::string& path, const std::string& c
     ofs.write(content.data(), static_cast<std::streamsize>(content.size()));
     return ofs.good();
 }
+// size and last-write time of a file; all zero when it does not exist
+struct FileStamp {
+    std::uint64_t size{0}, mtime{0};
+    bool operator==(const FileStamp&) const = default;
+};
+static inline FileStamp file_stamp(const std::string& path) {
+    WIN32_FILE_ATTRIBUTE_DATA a;
+    if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &a)) return {};
+    return {(std::uint64_t(a.nFileSizeHigh) << 32) | a.nFileSizeLow,
+            (std::uint64_t(a.ftLastWriteTime.dwHighDateTime) << 32) | a.ftLastWriteTime.dwLowDateTime};
+}
+// Read-only view of a whole file. The bytes stay valid until close() or
+// destruction; empty files have no mapping and yield an empty view.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& o) noexcept { swap(o); }
+    MappedFile& operator=(MappedFile&& o) noexcept { if (this != &o) { close(); swap(o); } return *this; }
+    ~MappedFile(){ close(); }
+
+    bool open(const std::string& path){
+        close();
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER sz{};
+        if (!GetFileSizeEx(file_, &sz) || sz.QuadPart < 0) { close(); return false; }
+        size_ = (std::size_t)sz.QuadPart;
+        if (size_ == 0) return true;
+        map_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!map_) { close(); return false; }
+        data_ = static_cast<const char*>(MapViewOfFile(map_, FILE_MAP_READ, 0, 0, 0));
+        if (!data_) { close(); return false; }
+        return true;
+    }
+    void close(){
+        if (data_) UnmapViewOfFile(data_);
+        if (map_) CloseHandle(map_);
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+        data_ = nullptr; map_ = nullptr; file_ = INVALID_HANDLE_VALUE; size_ = 0;
+    }
+    bool is_open() const { return file_ != INVALID_HANDLE_VALUE; }
+    std::string_view view() const { return data_ ? std::string_view(data_, size_) : std::string_view(); }
+
+private:
+    HANDLE file_{INVALID_HANDLE_VALUE};
+    HANDLE map_{nullptr};
+    const char* data_{nullptr};
+    std::size_t size_{0};
+    void swap(MappedFile& o) noexcept {
+        std::swap(file_, o.file_); std::swap(map_, o.map_); std::swap(data_, o.data_); std::swap(size_, o.size_);
+    }
+};
+
+// Sequential writer with one large buffer; spans at least as big as the
+// buffer (e.g. whole mapped pieces) go to WriteFile directly without a copy.
+class FileWriter {
+public:
+    static constexpr std::size_t BUFFER_BYTES = std::size_t(1) << 20;
+
+    FileWriter() = default;
+    FileWriter(const FileWriter&) = delete;
+    FileWriter& operator=(const FileWriter&) = delete;
+    ~FileWriter(){ if (h_ != INVALID_HANDLE_VALUE && !borrowed_) CloseHandle(h_); }
+
+    // "-" writes to standard output (which is left open afterwards)
+    bool open(const std::string& path){
+        if (path == "-") {
+            h_ = GetStdHandle(STD_OUTPUT_HANDLE); borrowed_ = true;
+            buf_.reserve(BUFFER_BYTES);
+            return ok_ = (h_ != INVALID_HANDLE_VALUE && h_ != nullptr);
+        }
+        h_ = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        buf_.reserve(BUFFER_BYTES);
+        return ok_ = (h_ != INVALID_HANDLE_VALUE);
+    }
+    bool write(std::string_view s){
+        if (!ok_) return false;
+        if (buf_.size() + s.size() > BUFFER_BYTES) flush();
+        if (s.size() >= BUFFER_BYTES) return ok_ = ok_ && write_raw(s);
+        buf_.append(s);
+        return ok_;
+    }
+    bool flush(){
+        if (ok_ && !buf_.empty()) ok_ = write_raw(buf_);
+        buf_.clear();
+        return ok_;
+    }
+    // flush, force the bytes to disk, and close; false if any write failed
+    bool close(){
+        flush();
+        if (h_ == INVALID_HANDLE_VALUE) return false;
+        if (borrowed_) { h_ = INVALID_HANDLE_VALUE; return ok_; }
+        if (ok_ && !FlushFileBuffers(h_)) ok_ = false;
+        CloseHandle(h_); h_ = INVALID_HANDLE_VALUE;
+        return ok_;
+    }
+
+private:
+    HANDLE h_{INVALID_HANDLE_VALUE};
+    std::string buf_;
+    bool ok_{false}, borrowed_{false};
+    bool write_raw(std::string_view s){
+        while (!s.empty()) {
+            DWORD n = (DWORD)std::min<std::size_t>(s.size(), std::size_t(1) << 30), w = 0;
+            if (!WriteFile(h_, s.data(), n, &w, nullptr) || w == 0) return false;
+            s.remove_prefix(w);
+        }
+        return true;
+    }
+};
+
+constexpr std::uint64_t FNV1A64_OFFSET = 0xcbf29ce484222325ULL;
+static inline std::uint64_t fnv1a64(std::uint64_t h, std::string_view s) {
+    for (unsigned char c : s) { h ^= c; h *= 0x100000001b3ULL; }
+    return h;
+}
+
+// Stream a file through fill(FileWriter&), which returns false on failure;
+// nothing is left behind if any step fails. Saves use "<path>.~tmp" next to
+// the target (same volume, so the final rename is atomic).
+template <class F>
+static bool write_temp_file(const std::string& tmp, F&& fill) {
+    FileWriter w;
+    bool ok = w.open(tmp) && fill(w);
+    ok = w.close() && ok;
+    if (!ok) DeleteFileA(tmp.c_str());
+    return ok;
+}
+// Replace path with tmp in one step: a crash leaves the old or the new file, never a torn one.
+static bool replace_with_temp(const std::string& tmp, const std::string& path) {
+    if (MoveFileExA(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) return true;
+    DeleteFileA(tmp.c_str());
+    return false;
+}
+
 static inline std::string trim_copy(std::string s) {
     auto issp = [](unsigned char c){ return std::isspace(c)!=0; };
     auto b = std::find_if_not(s.begin(), s.end(), issp);
@@ -71,14 +520,41 @@ static inline std::string trim_copy(std::string s) {
     if (b >= e) return {};
     return {b, e};
 }
-static inline std::vector<std::string> split_ws(const std::string& s) {
-    std::istringstream iss(s);
-    std::vector<std::string> v;
-    std::string t;
-    while (iss >> t) {
-        v.push_back(t);
+static inline std::string_view trim_view(std::string_view s) {
+    auto issp = [](unsigned char c){ return std::isspace(c)!=0; };
+    while (!s.empty() && issp((unsigned char)s.front())) s.remove_prefix(1);
+    while (!s.empty() && issp((unsigned char)s.back())) s.remove_suffix(1);
+    return s;
+}
+// Whitespace-separated words as views into the caller's line: parsing a
+// :command allocates nothing. A line with more than sixteen words keeps
+// the first sixteen and is flagged, so callers can refuse it.
+struct Words {
+    explicit Words(std::string_view s) {
+        for (std::size_t i = 0;;) {
+            while (i < s.size() && std::isspace((unsigned char)s[i])) ++i;
+            if (i == s.size()) break;
+            if (n_ == w_.size()) { overflow_ = true; break; }
+            std::size_t b = i;
+            while (i < s.size() && !std::isspace((unsigned char)s[i])) ++i;
+            w_[n_++] = s.substr(b, i - b);
+        }
     }
-    return v;
+    std::size_t size() const { return n_; }
+    bool empty() const { return !n_; }
+    bool overflow() const { return overflow_; }
+    std::string_view operator[](std::size_t i) const { return i < n_ ? w_[i] : std::string_view(); }
+private:
+    std::array<std::string_view, 16> w_{};
+    std::size_t n_{0};
+    bool overflow_{false};
+};
+// Whole-word decimal, no sign; false (v untouched) on anything else.
+static inline bool parse_u64(std::string_view s, std::uint64_t& v) {
+    std::uint64_t x = 0;
+    auto [p, ec] = std::from_chars(s.data(), s.data() + s.size(), x);
+    if (s.empty() || ec != std::errc() || p != s.data() + s.size()) return false;
+    v = x; return true;
 }
 static inline std::string json_escape(std::string_view s) {
     std::string out; out.reserve(s.size()+8);
@@ -99,130 +575,2417 @@ static inline std::string json_escape(std::string_view s) {
     return out;
 }
 
+// Streaming JSON pieces for FileWriter (or any sink with bool write(string_view)):
+// runs that need no escaping are written as they are, numbers are
+// formatted on the stack.
+struct StringSink {
+    std::string out;
+    bool write(std::string_view s){ out.append(s); return true; }
+};
+template <class W>
+static bool json_write_string(W& w, std::string_view s) {
+    static constexpr char HEX[] = "0123456789abcdef";
+    bool ok = w.write("\"");
+    std::size_t run = 0;
+    for (std::size_t i = 0; i < s.size(); ++i) {
+        unsigned char c = (unsigned char)s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        ok = ok && w.write(s.substr(run, i - run));
+        char esc[6] = {'\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 15]};
+        switch (c) {
+            case '"':  ok = ok && w.write("\\\""); break;
+            case '\\': ok = ok && w.write("\\\\"); break;
+            case '\b': ok = ok && w.write("\\b"); break;
+            case '\f': ok = ok && w.write("\\f"); break;
+            case '\n': ok = ok && w.write("\\n"); break;
+            case '\r': ok = ok && w.write("\\r"); break;
+            case '\t': ok = ok && w.write("\\t"); break;
+            default:   ok = ok && w.write(std::string_view(esc, 6));
+        }
+        run = i + 1;
+    }
+    return ok && w.write(s.substr(run)) && w.write("\"");
+}
+template <class W>
+static bool json_write_number(W& w, std::uint64_t v) {
+    char buf[24];
+    auto r = std::to_chars(buf, buf + sizeof(buf), v);
+    return w.write(std::string_view(buf, std::size_t(r.ptr - buf)));
+}
+template <class W>
+static bool json_write_number(W& w, double v) {
+    char buf[32];   // same digits ostream's default formatting gives
+    int n = std::snprintf(buf, sizeof(buf), "%g", v);
+    return w.write(std::string_view(buf, (std::size_t)std::max(0, n)));
+}
+
+// ============ parallel helpers ============
+
+static unsigned worker_count() { return std::max(1u, std::thread::hardware_concurrency()); }
+
+// Run fn(i) for every i in [0, n) on up to worker_count() threads. Items are
+// pulled from a shared counter, so uneven items still balance; the calling
+// thread works too and the call returns once every item is done.
+template <class F>
+static void parallel_for(std::size_t n, F&& fn) {
+    std::size_t threads = std::min<std::size_t>(worker_count(), n);
+    if (threads <= 1) { for (std::size_t i = 0; i < n; ++i) fn(i); return; }
+    std::atomic<std::size_t> next{0};
+    auto work = [&]{ for (std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < n; ) fn(i); };
+    std::vector<std::jthread> pool;
+    pool.reserve(threads - 1);
+    for (std::size_t t = 1; t < threads; ++t) pool.emplace_back(work);
+    work();
+}
+
 // ============ token analytics ============
 
+// Token -> count, looked up by std::string_view without building a key string.
+struct StringHash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view s) const noexcept { return std::hash<std::string_view>{}(s); }
+};
+using TokenFreq = std::unordered_map<std::string, std::size_t, StringHash, std::equal_to<>>;
+
 struct TokenStats {
     std::size_t chars{0}, lines{0}, tokens{0}, unique_tokens{0};
     double ttr{0.0}, avg_token_len{0.0}, char_entropy{0.0}, token_entropy{0.0};
     std::size_t digits{0}, letters{0}, whitespace{0}, punctuation{0};
-    std::unordered_map<std::string, std::size_t> freq;
+    TokenFreq freq;
+    // raw counters the derived fields above are computed from
+    std::array<std::uint64_t, 256> bytes{};
+    std::size_t token_bytes{0};
+};
+
+// Words are maximal runs of [A-Za-z0-9_] (ASCII only, independent of locale).
+static constexpr std::array<bool, 256> WORD_BYTE = []{
+    std::array<bool, 256> t{};
+    for (int c = 0; c < 256; ++c)
+        t[(std::size_t)c] = (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_';
+    return t;
+}();
+
+#if defined(__SSE2__)
+// bit i set <=> p[i] is a word byte
+static inline unsigned word_mask16(const char* p) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    auto in_range = [](__m128i v, char lo, char hi){
+        return _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(lo)), v),
+                             _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(hi)), v));
+    };
+    __m128i w = _mm_or_si128(in_range(x, '0', '9'), in_range(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 'z'));
+    w = _mm_or_si128(w, _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+    return (unsigned)_mm_movemask_epi8(w);
+}
+#endif
+
+// Resumable word scanner over one text fed in consecutive blocks. A word
+// that straddles a block boundary is reported once, when it ends; spans
+// point into the text and stay valid as long as the caller's text does.
+class WordScanner {
+public:
+    explicit WordScanner(const char* base): base_(base) {}
+
+    // scan bytes [from, to); emit(std::string_view) for every word that ends inside
+    template <class F> void scan(std::size_t from, std::size_t to, F&& emit){
+        const char* p = base_;
+        std::size_t i = from;
+#if defined(__SSE2__)
+        // 16 bytes per step; runs that stay inside (or outside) a word cost one compare
+        for (; i + 16 <= to; i += 16) {
+            unsigned m = word_mask16(p + i);
+            if (m == (start_ == NONE ? 0u : 0xFFFFu)) continue;
+            for (unsigned pos = 0; pos < 16; ) {
+                unsigned rest = ((start_ == NONE) ? m : ~m & 0xFFFFu) >> pos;
+                if (!rest) break;
+                pos += (unsigned)__builtin_ctz(rest);
+                if (start_ == NONE) start_ = i + pos;
+                else { emit(std::string_view(p + start_, i + pos - start_)); start_ = NONE; }
+            }
+        }
+#endif
+        for (; i < to; ++i) {
+            bool w = WORD_BYTE[(unsigned char)p[i]];
+            if (w && start_ == NONE) start_ = i;
+            else if (!w && start_ != NONE) { emit(std::string_view(p + start_, i - start_)); start_ = NONE; }
+        }
+    }
+    // end of text at byte `end`: flush a word still open there
+    template <class F> void finish(std::size_t end, F&& emit){
+        if (start_ != NONE) emit(std::string_view(base_ + start_, end - start_));
+        start_ = NONE;
+    }
+
+private:
+    static constexpr std::size_t NONE = std::string_view::npos;
+    const char* base_;
+    std::size_t start_{NONE};
 };
 
-static std::vector<std::string> tokenize_words(const std::string& s) {
+static std::vector<std::string_view> tokenize_words(std::string_view s) {
+    std::vector<std::string_view> out;
+    auto push = [&](std::string_view t){ out.push_back(t); };
+    WordScanner sc(s.data());
+    sc.scan(0, s.size(), push);
+    sc.finish(s.size(), push);
+    return out;
+}
+
+// std::regex reference for tokenize_words; kept for the --ab-tokenize check
+static std::vector<std::string> tokenize_words_regex(const std::string& s) {
     static const std::regex re(R"([A-Za-z0-9_]+)");
     std::vector<std::string> out;
     for (std::sregex_iterator it(s.begin(), s.end(), re), end; it != end; ++it) out.push_back(it->str());
     return out;
 }
 
-static double shannon_entropy(const std::unordered_map<char, std::size_t>& counts, std::size_t total) {
+static double shannon_entropy(const std::array<std::uint64_t, 256>& counts, std::size_t total) {
+    if (!total) return 0.0;
+    double H = 0.0;
+    for (auto n : counts) {
+        if (n) {
+            double p = double(n) / double(total);
+            H -= p * std::log2(p);
+        }
+    }
+    return H;
+}
+
+static double shannon_entropy_tokens(const TokenFreq& counts, std::size_t total) {
     if (!total) return 0.0;
     double H = 0.0;
-    for (auto& [c, n] : counts) {
+    for (auto& [t, n] : counts) {
         if (n) {
             double p = double(n) / double(total);
             H -= p * std::log2(p);
         }
     }
-    return H;
-}
+    return H;
+}
+
+// Character classes as std::isdigit/isalpha/isspace report them in the "C" locale.
+enum CharClass : std::uint8_t { CLS_DIGIT, CLS_LETTER, CLS_SPACE, CLS_PUNCT };
+static constexpr std::array<std::uint8_t, 256> CHAR_CLASS = []{
+    std::array<std::uint8_t, 256> t{};
+    for (int c = 0; c < 256; ++c) {
+        if (c >= '0' && c <= '9') t[(std::size_t)c] = CLS_DIGIT;
+        else if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')) t[(std::size_t)c] = CLS_LETTER;
+        else if (c == ' ' || (c >= '\t' && c <= '\r')) t[(std::size_t)c] = CLS_SPACE;
+        else t[(std::size_t)c] = CLS_PUNCT;
+    }
+    return t;
+}();
+
+static inline void count_token(TokenStats& st, std::string_view t) {
+    st.tokens++; st.token_bytes += t.size();
+    auto it = st.freq.find(t);
+    if (it != st.freq.end()) it->second++;
+    else st.freq.emplace(t, 1);
+}
+
+// Everything but token_entropy, from the raw counters; O(1) in the vocabulary size.
+static void finish_token_counts(TokenStats& st) {
+    st.chars = 0; st.digits = st.letters = st.whitespace = st.punctuation = 0;
+    std::array<std::size_t, 4> cls{};
+    for (std::size_t c = 0; c < 256; ++c) { st.chars += st.bytes[c]; cls[CHAR_CLASS[c]] += st.bytes[c]; }
+    st.digits = cls[CLS_DIGIT]; st.letters = cls[CLS_LETTER];
+    st.whitespace = cls[CLS_SPACE]; st.punctuation = cls[CLS_PUNCT];
+    st.lines = 1 + st.bytes[(unsigned char)'\n'];
+    st.unique_tokens = st.freq.size();
+    st.ttr = st.tokens? double(st.unique_tokens)/double(st.tokens) : 0.0;
+    st.avg_token_len = st.tokens? double(st.token_bytes)/double(st.tokens) : 0.0;
+    st.char_entropy  = shannon_entropy(st.bytes, st.chars);
+}
+
+// Derive every reported field from the raw counters (bytes, freq, tokens, token_bytes).
+static void finish_token_stats(TokenStats& st) {
+    finish_token_counts(st);
+    st.token_entropy = shannon_entropy_tokens(st.freq, st.tokens);
+}
+
+// One fused pass over cache-sized blocks: histogram a block into flat
+// counters, then tokenize it while it is still hot, interning each token
+// into freq as it is found. Class counts fall out of the histogram.
+static void accumulate_token_stats(TokenStats& st, std::string_view content) {
+    constexpr std::size_t BLOCK = 16 * 1024;
+    // four lanes so runs of one byte value don't serialize on a single counter
+    std::array<std::array<std::uint64_t, 256>, 4> h{};
+    const auto* p = reinterpret_cast<const unsigned char*>(content.data());
+    const std::size_t n = content.size();
+    auto tok = [&](std::string_view t){ count_token(st, t); };
+    WordScanner sc(content.data());
+    for (std::size_t at = 0; at < n; at += BLOCK) {
+        std::size_t to = std::min(n, at + BLOCK), i = at;
+        for (; i + 4 <= to; i += 4) { h[0][p[i]]++; h[1][p[i+1]]++; h[2][p[i+2]]++; h[3][p[i+3]]++; }
+        for (; i < to; ++i) h[0][p[i]]++;
+        sc.scan(at, to, tok);
+    }
+    sc.finish(n, tok);
+    for (std::size_t c = 0; c < 256; ++c) st.bytes[c] += h[0][c] + h[1][c] + h[2][c] + h[3][c];
+}
+
+// Add b's counts to a, walking the smaller table.
+static void merge_freq(TokenFreq& a, TokenFreq&& b) {
+    if (a.size() < b.size()) std::swap(a, b);
+    for (auto& [t, n] : b) a[t] += n;
+}
+
+// Fold b's raw counters into a (derived fields are left for finish_token_stats).
+static void merge_token_stats(TokenStats& a, TokenStats&& b) {
+    merge_freq(a.freq, std::move(b.freq));
+    for (std::size_t c = 0; c < 256; ++c) a.bytes[c] += b.bytes[c];
+    a.tokens += b.tokens; a.token_bytes += b.token_bytes;
+}
+
+// Map-reduce over chunks. Boundaries are nudged forward until they no longer
+// split a word, so every token is counted by exactly one chunk; partial
+// results are merged pairwise in parallel.
+static TokenStats parallel_token_stats(std::string_view content) {
+    constexpr std::size_t MIN_CHUNK = std::size_t(1) << 20;
+    std::size_t want = std::min<std::size_t>(worker_count() * 4, std::max<std::size_t>(1, content.size() / MIN_CHUNK));
+    std::vector<std::size_t> cut{0};
+    for (std::size_t k = 1; k < want; ++k) {
+        std::size_t b = std::max(cut.back(), content.size() * k / want);
+        while (b > 0 && b < content.size() && WORD_BYTE[(unsigned char)content[b-1]] && WORD_BYTE[(unsigned char)content[b]]) b++;
+        if (b > cut.back() && b < content.size()) cut.push_back(b);
+    }
+    cut.push_back(content.size());
+    std::vector<TokenStats> part(cut.size() - 1);
+    parallel_for(part.size(), [&](std::size_t i){ accumulate_token_stats(part[i], content.substr(cut[i], cut[i+1] - cut[i])); });
+    for (std::size_t step = 1; step < part.size(); step *= 2)
+        parallel_for((part.size() + 2*step - 1) / (2*step), [&](std::size_t j){
+            std::size_t a = j * 2 * step, b = a + step;
+            if (b < part.size()) merge_token_stats(part[a], std::move(part[b]));
+        });
+    TokenStats st = std::move(part.front());
+    finish_token_stats(st);
+    return st;
+}
+
+static TokenStats compute_token_stats(std::string_view content) {
+    // below a few MiB thread start-up costs more than it saves
+    if (content.size() >= (std::size_t(4) << 20) && worker_count() > 1) return parallel_token_stats(content);
+    TokenStats st{};
+    accumulate_token_stats(st, content);
+    finish_token_stats(st);
+    return st;
+}
+
+// Token stats kept current under edits. Words never cross a line break, so
+// an edit only changes the tokens of the lines it touches: the caller takes
+// those lines out before the splice and puts them back after it. Token
+// entropy uses the running sum of n*log2(n) over freq, H = log2(T) - S/T,
+// so reading the stats stays independent of the document size.
+// The first pass can also run piecemeal: counts then cover the document
+// prefix [0, covered()), which always ends on a line boundary.
+class LiveTokenStats {
+public:
+    bool active() const { return active_; }   // counting has started
+    bool valid() const { return done_; }      // ... and covers the whole document
+    std::size_t covered() const { return covered_; }
+    void invalidate(){ active_ = done_ = false; covered_ = 0; st_ = TokenStats{}; tok_nlogn_ = 0.0; }
+    void start(){ invalidate(); active_ = true; }
+    void rebuild(std::string_view text){
+        st_ = compute_token_stats(text);
+        tok_nlogn_ = 0.0;
+        for (auto& [t, n] : st_.freq) tok_nlogn_ += nlogn(n);
+        active_ = done_ = true; covered_ = text.size();
+    }
+    // count the lines that follow the covered prefix; last = they end the document
+    void extend(std::string_view region, bool last){ apply(region, +1); covered_ += region.size(); done_ = last; }
+    void set_covered(std::size_t n){ covered_ = n; }
+    // add / subtract the counts of a region that starts and ends on a line boundary
+    void add(std::string_view region){ apply(region, +1); }
+    void remove(std::string_view region){ apply(region, -1); }
+    const TokenStats& stats(){
+        finish_token_counts(st_);
+        double T = double(st_.tokens);
+        st_.token_entropy = st_.tokens ? std::max(0.0, std::log2(T) - tok_nlogn_ / T) : 0.0;
+        return st_;
+    }
+
+private:
+    TokenStats st_;
+    double tok_nlogn_{0.0};
+    std::size_t covered_{0};
+    bool active_{false}, done_{false};
+
+    static double nlogn(std::size_t n){ return n ? double(n) * std::log2(double(n)) : 0.0; }
+    void apply(std::string_view region, int sign){
+        for (unsigned char c : region) st_.bytes[c] += (std::uint64_t)(std::int64_t)sign;
+        auto bump = [&](std::string_view t){
+            auto it = st_.freq.find(t);
+            std::size_t old = (it != st_.freq.end()) ? it->second : 0, now = old + (std::size_t)(std::ptrdiff_t)sign;
+            tok_nlogn_ += nlogn(now) - nlogn(old);
+            if (!now) st_.freq.erase(it);
+            else if (it != st_.freq.end()) it->second = now;
+            else st_.freq.emplace(t, now);
+            st_.tokens += (std::size_t)(std::ptrdiff_t)sign;
+            st_.token_bytes += (std::size_t)(std::ptrdiff_t)sign * t.size();
+        };
+        WordScanner sc(region.data());
+        sc.scan(0, region.size(), bump);
+        sc.finish(region.size(), bump);
+    }
+};
+
+// ---- export formats ----
+
+// the scalar fields, each preceded by sep
+template <class W>
+static bool json_write_stats_fields(W& w, const TokenStats& st, std::string_view sep) {
+    bool ok = true;
+    auto field = [&](std::string_view name, auto v){
+        ok = ok && w.write(sep) && w.write("\"") && w.write(name) && w.write("\": ") && json_write_number(w, v);
+    };
+    field("lines", (std::uint64_t)st.lines);
+    field("chars", (std::uint64_t)st.chars);
+    field("tokens", (std::uint64_t)st.tokens);
+    field("unique_tokens", (std::uint64_t)st.unique_tokens);
+    field("type_token_ratio", st.ttr);
+    field("avg_token_length", st.avg_token_len);
+    field("char_entropy_bits", st.char_entropy);
+    field("token_entropy_bits", st.token_entropy);
+    return ok;
+}
+
+static bool write_token_stats_json(FileWriter& w, const TokenStats& st, std::string_view label) {
+    bool ok = w.write("{\n  \"file\": ") && json_write_string(w, label) && json_write_stats_fields(w, st, ",\n  ");
+    ok = ok && w.write(",\n  \"freq\": {");
+    bool first = true;
+    for (auto& [tok, cnt] : st.freq) {
+        ok = ok && w.write(first ? "\n    " : ",\n    ") && json_write_string(w, tok) && w.write(": ") && json_write_number(w, (std::uint64_t)cnt);
+        first = false;
+    }
+    if (!st.freq.empty()) ok = ok && w.write("\n  ");
+    return ok && w.write("}\n}\n");
+}
+
+// Columnar binary export, native little-endian, every column 8-byte aligned
+// so the file can be mapped and read in place:
+//   TokenStatsFileHeader                     64 bytes
+//   u64 bytes[256]                           byte histogram
+//   u64 counts[unique]                       count of token i
+//   u64 offsets[unique + 1]                  token i = blob[offsets[i], offsets[i+1])
+//   char blob[blob_bytes]                    token spellings back to back
+// Tokens appear in table order (not sorted).
+struct TokenStatsFileHeader {
+    char magic[8];                       // "VTOKST01"
+    std::uint64_t tokens, unique, chars, lines, blob_bytes;
+    std::uint64_t reserved[2];
+};
+static_assert(sizeof(TokenStatsFileHeader) == 64);
+
+static bool write_token_stats_bin(FileWriter& w, const TokenStats& st) {
+    TokenStatsFileHeader h{{'V','T','O','K','S','T','0','1'}, st.tokens, st.freq.size(), st.chars, st.lines, 0, {0, 0}};
+    std::size_t blob = 0;
+    for (auto& [tok, cnt] : st.freq) blob += tok.size();
+    h.blob_bytes = blob;
+    auto raw = [&](const void* p, std::size_t n){ return w.write(std::string_view(static_cast<const char*>(p), n)); };
+    bool ok = raw(&h, sizeof(h)) && raw(st.bytes.data(), sizeof(st.bytes));
+    for (auto& [tok, cnt] : st.freq) { std::uint64_t c = cnt; ok = ok && raw(&c, 8); }
+    std::uint64_t off = 0;
+    ok = ok && raw(&off, 8);
+    for (auto& [tok, cnt] : st.freq) { off += tok.size(); ok = ok && raw(&off, 8); }
+    for (auto& [tok, cnt] : st.freq) ok = ok && w.write(tok);
+    return ok;
+}
+
+static inline std::uint64_t mix64(std::uint64_t x) {   // splitmix64 finalizer
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Distinct tokens -> dense 32-bit ids (open addressing, linear probing).
+// Spellings are views into the text the tokens came from, which must
+// outlive the interner.
+class TokenInterner {
+public:
+    std::uint32_t intern(std::string_view t){
+        if ((words_.size() + 1) * 2 > slots_.size()) grow();
+        std::uint64_t h = std::hash<std::string_view>{}(t);
+        for (std::size_t i = h & (slots_.size() - 1);; i = (i + 1) & (slots_.size() - 1)) {
+            std::uint32_t s = slots_[i];
+            if (!s) {
+                words_.push_back(t); hashes_.push_back(h);
+                slots_[i] = (std::uint32_t)words_.size();
+                return slots_[i] - 1;
+            }
+            if (hashes_[s-1] == h && words_[s-1] == t) return s - 1;
+        }
+    }
+    std::string_view spelling(std::uint32_t id) const { return words_[id]; }
+    std::size_t size() const { return words_.size(); }
+
+private:
+    std::vector<std::string_view> words_;
+    std::vector<std::uint64_t> hashes_;
+    std::vector<std::uint32_t> slots_;   // id+1, 0 = empty; size is a power of two
+
+    void grow(){
+        std::vector<std::uint32_t> next(std::max<std::size_t>(1024, slots_.size() * 2), 0);
+        for (std::uint32_t id = 0; id < words_.size(); ++id) {
+            std::size_t i = hashes_[id] & (next.size() - 1);
+            while (next[i]) i = (i + 1) & (next.size() - 1);
+            next[i] = id + 1;
+        }
+        slots_.swap(next);
+    }
+};
+
+static std::vector<std::uint32_t> intern_words(std::string_view text, TokenInterner& in) {
+    std::vector<std::uint32_t> ids;
+    auto push = [&](std::string_view t){ ids.push_back(in.intern(t)); };
+    WordScanner sc(text.data());
+    sc.scan(0, text.size(), push);
+    sc.finish(text.size(), push);
+    return ids;
+}
+
+// Counts n-grams of token ids in an open-addressing table keyed on the id
+// tuple itself: a slot keeps the tuple's hash and the position of its first
+// occurrence in ids, so windows are compared in place and never copied.
+struct NgramSlot { std::uint64_t hash; std::size_t pos, count; };   // count 0: empty
+static std::vector<NgramSlot> count_ngrams(const std::vector<std::uint32_t>& ids, std::size_t n, std::size_t& used) {
+    using Slot = NgramSlot;
+    std::vector<Slot> table(1024, Slot{0, 0, 0});
+    used = 0;
+    if (!n || ids.size() < n) return table;
+    auto place = [](std::vector<Slot>& t, const Slot& s) -> Slot& {
+        std::size_t i = s.hash & (t.size() - 1);
+        while (t[i].count) i = (i + 1) & (t.size() - 1);
+        return t[i] = s;
+    };
+    const std::uint32_t* base = ids.data();
+    for (std::size_t i = 0; i + n <= ids.size(); ++i) {
+        std::uint64_t h = n;
+        for (std::size_t j = 0; j < n; ++j) h = mix64(h ^ base[i + j]);
+        std::size_t k = h & (table.size() - 1);
+        for (;; k = (k + 1) & (table.size() - 1)) {
+            Slot& s = table[k];
+            if (!s.count) { s = Slot{h, i, 1}; used++; break; }
+            if (s.hash == h && std::equal(base + s.pos, base + s.pos + n, base + i)) { s.count++; break; }
+        }
+        if (used * 2 > table.size()) {
+            std::vector<Slot> next(table.size() * 2, Slot{0, 0, 0});
+            for (auto& s : table) if (s.count) place(next, s);
+            table.swap(next);
+        }
+    }
+    return table;
+}
+
+// Top-K comes from a partial sort; ties go to the n-gram seen first.
+static std::vector<std::pair<std::vector<std::string>, std::size_t>>
+top_ngrams(const std::vector<std::uint32_t>& ids, const TokenInterner& in, std::size_t n, std::size_t topk) {
+    if (!n || ids.size() < n || !topk) return {};
+    using Slot = NgramSlot;
+    std::size_t used;
+    auto table = count_ngrams(ids, n, used);
+    const std::uint32_t* base = ids.data();
+    std::vector<const Slot*> hits;
+    hits.reserve(used);
+    for (auto& s : table) if (s.count) hits.push_back(&s);
+    std::size_t k = std::min(topk, hits.size());
+    std::partial_sort(hits.begin(), hits.begin() + (std::ptrdiff_t)k, hits.end(), [](const Slot* a, const Slot* b){
+        return a->count != b->count ? a->count > b->count : a->pos < b->pos;
+    });
+    std::vector<std::pair<std::vector<std::string>, std::size_t>> vec;
+    vec.reserve(k);
+    for (std::size_t r = 0; r < k; ++r) {
+        std::vector<std::string> key;
+        key.reserve(n);
+        for (std::size_t j = 0; j < n; ++j) key.emplace_back(in.spelling(base[hits[r]->pos + j]));
+        vec.emplace_back(std::move(key), hits[r]->count);
+    }
+    return vec;
+}
+
+// Every n-gram with its count, keyed by its tokens joined with single
+// spaces (a token never holds one), so tables of many files merge like
+// token counts.
+static TokenFreq ngram_freq(const std::vector<std::uint32_t>& ids, const TokenInterner& in, std::size_t n) {
+    std::size_t used;
+    auto table = count_ngrams(ids, n, used);
+    TokenFreq out;
+    out.reserve(used);
+    std::string key;
+    for (auto& s : table) {
+        if (!s.count) continue;
+        key.clear();
+        for (std::size_t j = 0; j < n; ++j) { if (j) key += ' '; key += in.spelling(ids[s.pos + j]); }
+        out.emplace(key, s.count);
+    }
+    return out;
+}
+
+// the k largest counts of a table, ties in key order
+static std::vector<std::pair<std::string_view, std::size_t>> top_freq(const TokenFreq& f, std::size_t k) {
+    std::vector<std::pair<std::string_view, std::size_t>> v(f.begin(), f.end());
+    k = std::min(k, v.size());
+    std::partial_sort(v.begin(), v.begin() + (std::ptrdiff_t)k, v.end(), [](const auto& a, const auto& b){
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    v.resize(k);
+    return v;
+}
+
+// ============ corpus analytics ============
+// :tok corpus walks a tree (or a glob) in parallel, one directory level at
+// a time, counts every file on the worker pool and merges the per-file
+// tables into corpus totals. Per-file results are cached on disk, one entry
+// per (file, n), keyed by full path, size and last-write time, so a rerun
+// over a mostly unchanged tree only reads the files that changed.
+//
+// Cache entry (native little-endian): TokCacheHeader, the path, u64
+// bytes[256], then `unique` token and `grams` n-gram records of
+// { u64 count, u32 length, spelling }.
+
+struct CorpusFile { std::string path; FileStamp stamp; };
+
+struct TokCacheHeader {
+    char magic[8];                      // "VTOKC001"
+    std::uint64_t size, mtime, n, path_len, tokens, token_bytes, unique, grams;
+};
+
+// '*' and '?' over one file name
+static bool wild_match(std::string_view pat, std::string_view name) {
+    std::size_t p = 0, q = 0, star = std::string_view::npos, mark = 0;
+    while (q < name.size()) {
+        if (p < pat.size() && (pat[p] == '?' || pat[p] == name[q])) { ++p; ++q; }
+        else if (p < pat.size() && pat[p] == '*') { star = p++; mark = q; }
+        else if (star != std::string_view::npos) { p = star + 1; q = ++mark; }
+        else return false;
+    }
+    while (p < pat.size() && pat[p] == '*') ++p;
+    return p == pat.size();
+}
+
+// Regular files below `root` whose names match `pattern`, sorted by path.
+// Names starting with '.' (.git, swap files) are skipped, and so are
+// reparse points, so links cannot loop.
+static std::vector<CorpusFile> walk_corpus(const std::string& root, std::string_view pattern, bool recursive) {
+    const char sep = root.find('/') != std::string::npos && root.find('\\') == std::string::npos ? '/' : '\\';
+    std::vector<std::string> level{root};
+    std::vector<CorpusFile> files;
+    std::mutex mu;
+    while (!level.empty()) {
+        std::vector<std::string> next;
+        parallel_for(level.size(), [&](std::size_t i){
+            const std::string& dir = level[i];
+            std::string prefix = dir.empty() || dir.back() == '/' || dir.back() == '\\' ? dir : dir + sep;
+            std::vector<std::string> subdirs;
+            std::vector<CorpusFile> found;
+            WIN32_FIND_DATAA fd;
+            HANDLE h = FindFirstFileA((prefix + "*").c_str(), &fd);
+            if (h == INVALID_HANDLE_VALUE) return;
+            do {
+                std::string_view name = fd.cFileName;
+                if (name.empty() || name[0] == '.' || (fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) continue;
+                if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) { if (recursive) subdirs.push_back(prefix + std::string(name)); }
+                else if (wild_match(pattern, name))
+                    found.push_back({prefix + std::string(name), {(std::uint64_t(fd.nFileSizeHigh) << 32) | fd.nFileSizeLow,
+                                     (std::uint64_t(fd.ftLastWriteTime.dwHighDateTime) << 32) | fd.ftLastWriteTime.dwLowDateTime}});
+            } while (FindNextFileA(h, &fd));
+            FindClose(h);
+            std::lock_guard lock(mu);
+            next.insert(next.end(), std::make_move_iterator(subdirs.begin()), std::make_move_iterator(subdirs.end()));
+            files.insert(files.end(), std::make_move_iterator(found.begin()), std::make_move_iterator(found.end()));
+        });
+        level.swap(next);
+    }
+    std::sort(files.begin(), files.end(), [](const CorpusFile& a, const CorpusFile& b){ return a.path < b.path; });
+    return files;
+}
+
+// What one file contributes: raw token counters (not finished) and, for
+// n >= 2, its n-gram table.
+struct FileTokens { TokenStats st; TokenFreq grams; };
+
+static std::string tok_cache_path(const std::string& dir, const std::string& full, std::size_t n) {
+    char name[40];
+    std::snprintf(name, sizeof(name), "%016llx.tok", (unsigned long long)fnv1a64(fnv1a64(FNV1A64_OFFSET, full), std::to_string(n)));
+    return dir + name;
+}
+static std::optional<FileTokens> load_tok_cache(const std::string& at, const std::string& full, FileStamp stamp, std::size_t n) {
+    MappedFile mf;
+    if (!mf.open(at)) return std::nullopt;
+    std::string_view v = mf.view();
+    TokCacheHeader h;
+    if (v.size() < sizeof h) return std::nullopt;
+    std::memcpy(&h, v.data(), sizeof h);
+    if (std::memcmp(h.magic, "VTOKC001", 8) || h.size != stamp.size || h.mtime != stamp.mtime || h.n != n
+        || v.size() - sizeof h < h.path_len + sizeof(std::uint64_t) * 256 || v.substr(sizeof h, h.path_len) != full) return std::nullopt;
+    FileTokens ft;
+    std::size_t at_byte = sizeof h + h.path_len;
+    std::memcpy(ft.st.bytes.data(), v.data() + at_byte, sizeof ft.st.bytes); at_byte += sizeof ft.st.bytes;
+    ft.st.tokens = h.tokens; ft.st.token_bytes = h.token_bytes;
+    auto records = [&](TokenFreq& f, std::uint64_t count){
+        f.reserve(count);
+        for (std::uint64_t r = 0; r < count; ++r) {
+            std::uint64_t c; std::uint32_t len;
+            if (v.size() - at_byte < 12) return false;
+            std::memcpy(&c, v.data() + at_byte, 8); std::memcpy(&len, v.data() + at_byte + 8, 4); at_byte += 12;
+            if (v.size() - at_byte < len) return false;
+            f.emplace(v.substr(at_byte, len), c); at_byte += len;
+        }
+        return true;
+    };
+    if (!records(ft.st.freq, h.unique) || !records(ft.grams, h.grams)) return std::nullopt;
+    return ft;
+}
+static bool store_tok_cache(const std::string& at, const std::string& full, FileStamp stamp, std::size_t n, const FileTokens& ft) {
+    TokCacheHeader h{{'V','T','O','K','C','0','0','1'}, stamp.size, stamp.mtime, n, full.size(),
+                     ft.st.tokens, ft.st.token_bytes, ft.st.freq.size(), ft.grams.size()};
+    std::string tmp = at + ".~tmp";
+    return write_temp_file(tmp, [&](FileWriter& w){
+        auto raw = [&](const void* p, std::size_t len){ return w.write(std::string_view(static_cast<const char*>(p), len)); };
+        bool ok = raw(&h, sizeof h) && w.write(full) && raw(ft.st.bytes.data(), sizeof ft.st.bytes);
+        for (const TokenFreq* f : {&ft.st.freq, &ft.grams})
+            for (auto& [t, c] : *f) {
+                std::uint64_t c64 = c; std::uint32_t len = (std::uint32_t)t.size();
+                ok = ok && raw(&c64, 8) && raw(&len, 4) && w.write(t);
+            }
+        return ok;
+    }) && replace_with_temp(tmp, at);
+}
+
+// A directory (walked whole), a single file, or dir/pattern, where a last
+// directory component of "**" makes the walk recursive: src/**/*.cpp
+static std::vector<CorpusFile> corpus_files(const std::string& spec) {
+    WIN32_FILE_ATTRIBUTE_DATA a;
+    if (GetFileAttributesExA(spec.c_str(), GetFileExInfoStandard, &a)) {
+        if (a.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) return walk_corpus(spec, "*", true);
+        return {{spec, file_stamp(spec)}};
+    }
+    std::size_t cut = spec.find_last_of("/\\");
+    std::string dir = cut == std::string::npos ? "." : spec.substr(0, cut ? cut : 1);
+    std::string pattern = cut == std::string::npos ? spec : spec.substr(cut + 1);
+    bool recursive = dir == "**" || dir.ends_with("/**") || dir.ends_with("\\**");
+    if (recursive) { dir.resize(dir.size() - 2); if (dir.empty()) dir = "."; }
+    return pattern.empty() ? std::vector<CorpusFile>{} : walk_corpus(dir, pattern, recursive);
+}
+
+// %TEMP%\vimified-tokcache\, created on first use; empty if it can't be
+static std::string tok_cache_dir() {
+    char tmp[MAX_PATH];
+    DWORD n = GetTempPathA(MAX_PATH, tmp);
+    if (!n || n >= MAX_PATH) return {};
+    std::string dir = std::string(tmp, n) + "vimified-tokcache\\";
+    CreateDirectoryA(dir.c_str(), nullptr);
+    WIN32_FILE_ATTRIBUTE_DATA a;
+    bool ok = GetFileAttributesExA(dir.c_str(), GetFileExInfoStandard, &a) && (a.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+    return ok ? dir : std::string();
+}
+
+struct CorpusStats {
+    std::size_t files{0}, cached{0}, unreadable{0};
+    std::uint64_t bytes{0};
+    TokenStats stats;                   // finished
+    TokenFreq grams;                    // n >= 2
+};
+
+// cache_dir empty: no cache
+static CorpusStats corpus_stats(const std::vector<CorpusFile>& files, std::size_t n, const std::string& cache_dir) {
+    CorpusStats cs;
+    cs.files = files.size();
+    std::vector<FileTokens> part(files.size());
+    std::atomic<std::size_t> cached{0}, unreadable{0};
+    parallel_for(files.size(), [&](std::size_t i){
+        const CorpusFile& f = files[i];
+        char full[MAX_PATH];
+        DWORD len = GetFullPathNameA(f.path.c_str(), MAX_PATH, full, nullptr);
+        std::string key = len && len < MAX_PATH ? std::string(full, len) : f.path;
+        std::string entry = cache_dir.empty() ? std::string() : tok_cache_path(cache_dir, key, n);
+        if (!entry.empty()) if (auto hit = load_tok_cache(entry, key, f.stamp, n)) { part[i] = std::move(*hit); cached++; return; }
+        MappedFile mf; std::string owned; std::string_view text;
+        if (mf.open(f.path)) text = mf.view();
+        else if (auto s = read_text_file(f.path)) { owned = std::move(*s); text = owned; }
+        else { unreadable++; return; }
+        accumulate_token_stats(part[i].st, text);
+        if (n >= 2) { TokenInterner in; part[i].grams = ngram_freq(intern_words(text, in), in, n); }
+        if (!entry.empty()) store_tok_cache(entry, key, f.stamp, n, part[i]);
+    });
+    cs.cached = cached; cs.unreadable = unreadable;
+    for (auto& f : files) cs.bytes += f.stamp.size;
+    // pairwise merges, each round in parallel
+    for (std::size_t step = 1; step < part.size(); step *= 2)
+        parallel_for((part.size() + 2*step - 1) / (2*step), [&](std::size_t j){
+            std::size_t a = j * 2 * step, b = a + step;
+            if (b < part.size()) { merge_token_stats(part[a].st, std::move(part[b].st)); merge_freq(part[a].grams, std::move(part[b].grams)); }
+        });
+    if (!part.empty()) { cs.stats = std::move(part.front().st); cs.grams = std::move(part.front().grams); }
+    finish_token_stats(cs.stats);
+    return cs;
+}
+
+// ============ token composition ============
+// Every string of `len` symbols over an alphabet, in odometer order: string
+// i is i written in base |alphabet|, most significant digit first. With the
+// default alphabet {1,2,3} that is 111, 112, 113, 121, ...
+
+static constexpr std::array<char, 3> SAFE_ALPHABET{ '1','2','3' };
+
+// base^exp by squaring; false if it does not fit in 64 bits
+static bool safe_pow_u64(std::uint64_t base,std::uint64_t exp,std::uint64_t& out){
+    constexpr std::uint64_t MAX = (std::numeric_limits<std::uint64_t>::max)();
+    out=1;
+    for(std::uint64_t b=base; exp; exp>>=1){
+        if((exp&1) && b && out>MAX/b) return false;
+        if(exp&1) out*=b;
+        if(exp>1 && b && b>MAX/b) return false;
+        if(exp>1) b*=b;
+    }
+    return true;
+}
+
+// Streams the sequence from index `start`, at most `count` strings, one per
+// line. The start index is decoded into digits once; after that each string
+// is one odometer step from the previous one (no division per symbol), so
+// shards of one sequence can be produced independently by start offset.
+// Common shapes (base 2/3/4/10/16, length <= 16) run a kernel instantiated
+// for that base and length, picked once at construction.
+class PermutationStream {
+public:
+    static constexpr std::uint64_t ALL = (std::numeric_limits<std::uint64_t>::max)();
+    static constexpr std::size_t MAX_FIXED_LEN = 16;
+    static constexpr std::size_t MAX_LEN = 4096;   // longest string the callers accept
+
+    PermutationStream(std::string_view alphabet, std::size_t len, std::uint64_t start = 0, std::uint64_t count = ALL)
+        : alpha_(alphabet), digit_(len, 0), line_(len + 1, '\n') {
+        if (alpha_.empty() || !len) return;
+        std::uint64_t total;
+        if (!safe_pow_u64(alpha_.size(), len, total)) total = ALL;   // more than anyone can ask for
+        left_ = start >= total ? 0 : std::min(count, total - start);
+        for (std::size_t j = len; j-- > 0; start /= alpha_.size()) digit_[j] = std::size_t(start % alpha_.size());
+        for (std::size_t j = 0; j < len; ++j) line_[j] = alpha_[digit_[j]];
+        kernel_ = pick_kernel(alpha_.size(), len);
+    }
+    std::uint64_t remaining() const { return left_; }
+    std::size_t line_width() const { return line_.size(); }
+    // write whole lines into out[0, cap); returns the bytes written
+    std::size_t fill(char* out, std::size_t cap){ return kernel_(*this, out, cap); }
+
+private:
+    using Kernel = std::size_t (*)(PermutationStream&, char*, std::size_t);
+
+    std::string alpha_;
+    std::vector<std::size_t> digit_;
+    std::string line_;                 // current string plus its '\n'
+    std::uint64_t left_{0};
+    Kernel kernel_{&fill_generic};
+
+    static std::size_t fill_generic(PermutationStream& ps, char* out, std::size_t cap){
+        std::size_t n = 0, w = ps.line_.size();
+        for (; ps.left_ && n + w <= cap; --ps.left_) {
+            std::memcpy(out + n, ps.line_.data(), w); n += w;
+            ps.step();
+        }
+        return n;
+    }
+    // Suffix digits covered by one pre-rendered block of lines (about 16 KiB).
+    template <std::size_t B, std::size_t L>
+    static constexpr std::size_t block_digits(){
+        std::size_t t = 0, lines = 1;
+        while (t < L && lines * B * (L + 1) <= 16384) { lines *= B; ++t; }
+        return t;
+    }
+    // Base and width are constants here. The last T digits cycle through
+    // a block of B^T lines rendered once per call with only the prefix
+    // patched in, so aligned stretches are one copy of the whole block plus
+    // a byte per line when the prefix ticks. Unaligned heads and tails step
+    // line by line, sweeping the last digit in a tight run.
+    template <std::size_t B, std::size_t L>
+    static std::size_t fill_fixed(PermutationStream& ps, char* out, std::size_t cap){
+        constexpr std::size_t W = L + 1, T = block_digits<B, L>(), P = L - T;
+        constexpr std::size_t BL = []{ std::size_t r = 1; for (std::size_t i = 0; i < T; ++i) r *= B; return r; }();
+        std::array<char, B> sym;
+        std::array<char, W> line;
+        std::array<std::size_t, L> d;
+        std::memcpy(sym.data(), ps.alpha_.data(), B);
+        std::memcpy(line.data(), ps.line_.data(), W);
+        std::copy(ps.digit_.begin(), ps.digit_.end(), d.begin());
+        std::uint64_t left = ps.left_;
+        std::size_t n = 0;
+        std::array<char, BL * W> blk;
+        bool blk_ready = false;
+        auto aligned = [&]{ for (std::size_t j = P; j < L; ++j) if (d[j]) return false; return true; };
+        while (left && n + W <= cap) {
+            if (left >= BL && cap - n >= BL * W && aligned()) {
+                if (!blk_ready) {
+                    for (std::size_t k = 0; k < BL; ++k) {
+                        char* l = blk.data() + k * W;
+                        std::memcpy(l, line.data(), W);
+                        for (std::size_t j = L, v = k; j-- > P; v /= B) l[j] = sym[v % B];
+                    }
+                    blk_ready = true;
+                }
+                std::memcpy(out + n, blk.data(), BL * W); n += BL * W;
+                left -= BL;
+                for (std::size_t j = P; j-- > 0;) {
+                    bool wrap = ++d[j] == B;
+                    if (wrap) d[j] = 0;
+                    line[j] = sym[d[j]];
+                    for (std::size_t k = 0; k < BL; ++k) blk[k * W + j] = line[j];
+                    if (!wrap) break;
+                }
+                continue;
+            }
+            std::size_t last = d[L-1];
+            std::size_t run = (std::size_t)std::min<std::uint64_t>({B - last, left, (cap - n) / W});
+            for (std::size_t k = 0; k < run; ++k) {
+                line[L-1] = sym[last + k];
+                std::memcpy(out + n, line.data(), W); n += W;
+            }
+            left -= run;
+            d[L-1] = last + run;
+            if (d[L-1] < B) { line[L-1] = sym[d[L-1]]; continue; }
+            d[L-1] = 0; line[L-1] = sym[0];
+            for (std::size_t j = L - 1; j-- > 0;) {
+                if (++d[j] < B) { line[j] = sym[d[j]]; break; }
+                d[j] = 0; line[j] = sym[0];
+            }
+            if (blk_ready) for (std::size_t j = 0; j < P; ++j) for (std::size_t k = 0; k < BL; ++k) blk[k * W + j] = line[j];
+        }
+        std::memcpy(ps.line_.data(), line.data(), W);
+        std::copy(d.begin(), d.end(), ps.digit_.begin());
+        ps.left_ = left;
+        return n;
+    }
+    template <std::size_t B, std::size_t... L>
+    static constexpr std::array<Kernel, sizeof...(L)> kernels_for(std::index_sequence<L...>){ return {&fill_fixed<B, L + 1>...}; }
+    static Kernel pick_kernel(std::size_t base, std::size_t len){
+        static constexpr auto k2  = kernels_for<2>(std::make_index_sequence<MAX_FIXED_LEN>{});
+        static constexpr auto k3  = kernels_for<3>(std::make_index_sequence<MAX_FIXED_LEN>{});
+        static constexpr auto k4  = kernels_for<4>(std::make_index_sequence<MAX_FIXED_LEN>{});
+        static constexpr auto k10 = kernels_for<10>(std::make_index_sequence<MAX_FIXED_LEN>{});
+        static constexpr auto k16 = kernels_for<16>(std::make_index_sequence<MAX_FIXED_LEN>{});
+        if (!len || len > MAX_FIXED_LEN) return &fill_generic;
+        switch (base) {
+            case 2:  return k2[len-1];
+            case 3:  return k3[len-1];
+            case 4:  return k4[len-1];
+            case 10: return k10[len-1];
+            case 16: return k16[len-1];
+            default: return &fill_generic;
+        }
+    }
+
+    void step(){
+        for (std::size_t j = digit_.size(); j-- > 0;) {
+            if (++digit_[j] < alpha_.size()) { line_[j] = alpha_[digit_[j]]; return; }
+            digit_[j] = 0; line_[j] = alpha_[0];
+        }
+    }
+};
+
+static std::string compose_permutations(std::string_view alphabet, std::uint64_t len, std::uint64_t start, std::uint64_t limit){
+    PermutationStream ps(alphabet, (std::size_t)len, start, limit);
+    std::string out((std::size_t)ps.remaining() * ps.line_width(), '\0');
+    out.resize(ps.fill(out.data(), out.size()));
+    return out;
+}
+
+// Blocks are sized so every full one bypasses the writer's own buffer.
+static bool stream_permutations(FileWriter& w, PermutationStream& ps){
+    std::string block(2 * FileWriter::BUFFER_BYTES + ps.line_width(), '\0');
+    while (ps.remaining())
+        if (!w.write(std::string_view(block.data(), ps.fill(block.data(), block.size())))) return false;
+    return true;
+}
+
+// ============ piece table ============
+// The document is a sequence of pieces pointing into two buffers: the
+// original file bytes (read-only) and an append-only add buffer. Each
+// buffer records the offsets of its '\n' bytes, so a piece knows its line
+// count without rescanning text. Prefix sums over the piece list (bytes and
+// line feeds before each piece) are rebuilt lazily from the first piece an
+// edit touched; an edit therefore costs O(log + pieces after it), never
+// O(file size). A '\r' directly before '\n' belongs to the line terminator
+// and is hidden from line text and column math.
+//
+// A mapped original is indexed by a background thread. Until it finishes,
+// the pieces cover only the original up to the last newline adopted so far
+// (the frontier); the rest of the file is an implicit, untouched suffix.
+// Edits can only happen inside the indexed prefix, so that suffix never
+// needs to be split. poll_index() adopts progress; ensure_lines() waits for it.
+
+// make room for n more elements, at least doubling the capacity when it grows
+template <class C> static void reserve_ahead(C& c, std::size_t n){
+    if (c.capacity() - c.size() < n) c.reserve(std::max(c.size() + n, c.capacity() * 2));
+}
+
+class PieceTable {
+public:
+    PieceTable() { reset(std::string()); }
+    PieceTable(const PieceTable&) = delete;
+    PieceTable& operator=(const PieceTable&) = delete;
+
+    void reset(std::string original){
+        stop_indexer();
+        map_.close();
+        orig_.own = std::move(original); orig_.ext = {};
+        clear_pieces();
+        index_newlines(orig_.bytes(), 0, orig_.bytes().size(), orig_.nl);
+        extend_original(orig_.bytes().size());
+    }
+    // take ownership of a mapping; the document points straight into its bytes
+    void reset(MappedFile file){
+        stop_indexer();
+        map_ = std::move(file);
+        orig_.own.clear(); orig_.own.shrink_to_fit(); orig_.ext = map_.view();
+        clear_pieces();
+        if (orig_.ext.size() <= INDEX_BLOCK) {
+            index_newlines(orig_.ext, 0, orig_.ext.size(), orig_.nl);
+            extend_original(orig_.ext.size());
+            return;
+        }
+        indexing_ = true;
+        indexer_ = std::jthread([this, bytes = orig_.ext](std::stop_token st){
+            std::vector<std::size_t> found;
+            for (std::size_t at = 0; at < bytes.size() && !st.stop_requested(); ) {
+                std::size_t to = std::min(bytes.size(), at + INDEX_BLOCK);
+                found.clear(); index_newlines(bytes, at, to, found);
+                {
+                    std::lock_guard<std::mutex> lk(idx_mu_);
+                    idx_staged_.insert(idx_staged_.end(), found.begin(), found.end());
+                    idx_done_ = (to == bytes.size());
+                }
+                idx_cv_.notify_all(); wake_ui();
+                at = to;
+            }
+        });
+    }
+
+    // adopt newline offsets found by the background indexer; true if the document grew
+    bool poll_index(){
+        if (!indexing_) return false;
+        std::vector<std::size_t> got; bool done;
+        { std::lock_guard<std::mutex> lk(idx_mu_); got.swap(idx_staged_); done = idx_done_; }
+        std::size_t before = frontier_;
+        orig_.nl.insert(orig_.nl.end(), got.begin(), got.end());
+        if (done) { extend_original(orig_.ext.size()); indexing_ = false; }
+        else if (!orig_.nl.empty()) extend_original(orig_.nl.back() + 1);
+        return frontier_ != before;
+    }
+    // block until at least n line feeds are known (or the whole file is indexed)
+    void ensure_lines(std::size_t n){
+        while (indexing_ && lf_total_ < n) {
+            {
+                std::unique_lock<std::mutex> lk(idx_mu_);
+                idx_cv_.wait(lk, [&]{ return !idx_staged_.empty() || idx_done_; });
+            }
+            poll_index();
+        }
+    }
+    void ensure_indexed(){ ensure_lines((std::numeric_limits<std::size_t>::max)()); }
+    bool indexing() const { return indexing_; }
+    bool mapped() const { return map_.is_open(); }
+    // A mapped file cannot be replaced while mapped. detach() closes the
+    // mapping (the document must not be read until reattach or reset);
+    // reattach() maps the same, unchanged file again after a failed save.
+    void detach(){
+        ensure_indexed();
+        map_.close();
+    }
+    bool reattach(const std::string& path){
+        MappedFile mf;
+        if (!mf.open(path) || mf.view().size() != orig_.ext.size()) return false;
+        map_ = std::move(mf); orig_.ext = map_.view();
+        return true;
+    }
+
+    std::size_t size() const { return size_; }
+    std::size_t line_count() const { return lf_total_ + 1; }
+    bool crlf() const { return crlf_; }
+    std::string_view eol() const { return crlf_ ? "\r\n" : "\n"; }
+
+    std::size_t line_start(std::size_t y) const {
+        if (y == 0) return 0;
+        if (y > lf_total_) return size_;
+        sync();
+        // last piece with fewer than y line feeds before it holds the y-th '\n'
+        std::size_t i = std::size_t(std::lower_bound(lfs_.begin(), lfs_.begin() + (std::ptrdiff_t)pieces_.size(), y) - lfs_.begin()) - 1;
+        const Piece& p = pieces_[i];
+        const Source& src = source(p);
+        std::size_t first = std::size_t(std::lower_bound(src.nl.begin(), src.nl.end(), p.off) - src.nl.begin());
+        std::size_t nl = src.nl[first + (y - lfs_[i]) - 1];
+        return pos_[i] + (nl - p.off) + 1;
+    }
+    // bytes of the terminator that ends line y ("\n", "\r\n", or 0 on the last line)
+    std::size_t eol_length(std::size_t y) const {
+        if (y >= lf_total_) return 0;
+        std::size_t start = line_start(y), nl = line_start(y+1) - 1;
+        return (nl > start && byte_at(nl-1) == '\r') ? 2 : 1;
+    }
+    std::size_t line_length(std::size_t y) const {
+        if (y > lf_total_) return 0;
+        std::size_t start = line_start(y);
+        if (y == lf_total_) return size_ - start;
+        std::size_t nl = line_start(y+1) - 1;
+        return nl - start - ((nl > start && byte_at(nl-1) == '\r') ? 1 : 0);
+    }
+    std::string line(std::size_t y) const { return substr(line_start(y), line_length(y)); }
+    std::size_t offset_of(std::size_t y, std::size_t x) const { return line_start(y) + std::min(x, line_length(y)); }
+    // line holding byte pos (pos == size() is on the last line)
+    std::size_t line_of(std::size_t pos) const {
+        auto [i, in] = locate(pos);
+        if (i >= pieces_.size()) return lf_total_;
+        const Piece& p = pieces_[i];
+        const auto& nl = source(p).nl;
+        return lfs_[i] + std::size_t(std::lower_bound(nl.begin(), nl.end(), p.off + in) - std::lower_bound(nl.begin(), nl.end(), p.off));
+    }
+
+    // bytes [pos, pos+n): a view into the original when they lie inside one of
+    // its pieces, otherwise a copy kept in `owned` (the add buffer may move)
+    std::string_view span(std::size_t pos, std::size_t n, std::deque<std::string>& owned) const {
+        auto [i, in] = locate(pos);
+        if (i < pieces_.size() && !pieces_[i].add && in + n <= pieces_[i].len) return view(pieces_[i]).substr(in, n);
+        return owned.emplace_back(substr(pos, n));
+    }
+
+    char byte_at(std::size_t pos) const {
+        auto [i, in] = locate(pos);
+        return i < pieces_.size() ? view(pieces_[i])[in] : '\0';
+    }
+    std::string substr(std::size_t pos, std::size_t n) const {
+        std::string out;
+        if (pos >= size_) return out;
+        n = std::min(n, size_ - pos); out.reserve(n);
+        auto [i, in] = locate(pos);
+        for (; i < pieces_.size() && out.size() < n; ++i, in = 0)
+            out.append(view(pieces_[i]).substr(in, n - out.size()));
+        return out;
+    }
+    // substr() into a caller-owned string, reusing its capacity
+    void copy(std::size_t pos, std::size_t n, std::string& out) const {
+        out.clear(); for_range(pos, n, [&](std::string_view v){ out.append(v); });
+    }
+    // visit bytes [pos, pos+n) as contiguous runs, without copying
+    template <class F> void for_range(std::size_t pos, std::size_t n, F&& f) const {
+        if (pos >= size_) return;
+        n = std::min(n, size_ - pos);
+        auto [i, in] = locate(pos);
+        for (; i < pieces_.size() && n; ++i, in = 0) {
+            std::string_view v = view(pieces_[i]).substr(in, n);
+            f(v); n -= v.size();
+        }
+    }
+    // visit the document in storage order, one contiguous run per piece
+    // (includes the not yet indexed suffix of a mapped original)
+    template <class F> void for_each_chunk(F&& f) const {
+        for (auto& p : pieces_) f(view(p));
+        if (frontier_ < orig_.bytes().size()) f(orig_.bytes().substr(frontier_));
+    }
+    std::size_t total_size() const { return size_ + (orig_.bytes().size() - frontier_); }
+    // bytes the document keeps in memory: owned text, line index, piece
+    // arrays, and the mapped view (counted whole, as its pages may all be resident)
+    std::size_t footprint() const {
+        return orig_.own.capacity() + add_.own.capacity() + orig_.ext.size()
+             + (orig_.nl.capacity() + add_.nl.capacity() + pos_.capacity() + lfs_.capacity()) * sizeof(std::size_t)
+             + pieces_.capacity() * sizeof(Piece);
+    }
+    // Room for the next `bytes` inserted bytes in up to `pieces` new pieces,
+    // grown geometrically; the editor calls it between keystrokes so that
+    // typing itself does not allocate.
+    void reserve_edits(std::size_t bytes, std::size_t pieces){
+        reserve_ahead(add_.own, bytes); reserve_ahead(add_.nl, bytes);
+        reserve_ahead(pieces_, pieces);
+        reserve_ahead(pos_, pieces + 1); reserve_ahead(lfs_, pieces + 1);
+    }
+    std::string text() const { std::string out; out.reserve(total_size()); for_each_chunk([&](std::string_view v){ out.append(v); }); return out; }
+
+    void insert(std::size_t pos, std::string_view s){
+        if (s.empty()) return;
+        pos = std::min(pos, size_);
+        std::size_t off = add_.own.size(), nl0 = add_.nl.size();
+        add_.own.append(s); index_newlines(add_.own, off, add_.own.size(), add_.nl);
+        Piece np{true, off, s.size(), add_.nl.size() - nl0};
+        auto [i, in] = locate(pos);
+        if (in == 0 && i > 0 && pieces_[i-1].add && pieces_[i-1].off + pieces_[i-1].len == off) {
+            // typing extends the piece it just appended to
+            pieces_[i-1].len += np.len; pieces_[i-1].lf += np.lf; i--;
+        } else if (in == 0) {
+            pieces_.insert(pieces_.begin() + (std::ptrdiff_t)i, np);
+        } else {
+            Piece left = pieces_[i], right = pieces_[i];
+            left.len = in;               left.lf  = count_lf(left);
+            right.off += in; right.len -= in; right.lf = count_lf(right);
+            pieces_[i] = left;
+            pieces_.insert(pieces_.begin() + (std::ptrdiff_t)i + 1, {np, right});
+        }
+        size_ += np.len; lf_total_ += np.lf;
+        valid_ = std::min(valid_, i);
+    }
+    void erase(std::size_t pos, std::size_t n){
+        if (pos >= size_ || !n) return;
+        n = std::min(n, size_ - pos);
+        auto [i, a] = locate(pos);
+        auto [j, b] = locate(pos + n);
+        Piece keep[2]; std::size_t nk = 0;   // at most the two cut ends survive
+        if (a > 0) { Piece l = pieces_[i]; l.len = a; l.lf = count_lf(l); keep[nk++] = l; }
+        if (b > 0) { Piece r = pieces_[j]; r.off += b; r.len -= b; r.lf = count_lf(r); keep[nk++] = r; j++; }
+        std::size_t removed_lf = 0;
+        for (std::size_t k = i; k < j; ++k) removed_lf += pieces_[k].lf;
+        for (std::size_t k = 0; k < nk; ++k) removed_lf -= keep[k].lf;
+        pieces_.erase(pieces_.begin() + (std::ptrdiff_t)i, pieces_.begin() + (std::ptrdiff_t)j);
+        pieces_.insert(pieces_.begin() + (std::ptrdiff_t)i, keep, keep + nk);
+        size_ -= n; lf_total_ -= removed_lf;
+        valid_ = std::min(valid_, i);
+    }
+
+private:
+    static constexpr std::size_t INDEX_BLOCK = std::size_t(1) << 20;
+
+    struct Source {
+        std::string own;                 // owned bytes (add buffer, or a read-in original)
+        std::string_view ext;            // mapped bytes, when the original is a MappedFile
+        std::vector<std::size_t> nl;     // offsets of '\n'
+        std::string_view bytes() const { return ext.data() ? ext : std::string_view(own); }
+    };
+    struct Piece { bool add; std::size_t off, len, lf; };
+
+    MappedFile map_;
+    Source orig_, add_;
+    std::vector<Piece> pieces_;
+    std::size_t size_{0}, lf_total_{0};
+    std::size_t frontier_{0};            // original bytes [0, frontier_) are in pieces_
+    bool crlf_{false};
+    // pos_[i] / lfs_[i]: bytes / line feeds before piece i, valid for i <= valid_
+    mutable std::vector<std::size_t> pos_, lfs_;
+    mutable std::size_t valid_{0};
+
+    // background line indexer (declared last so it is joined before the rest goes away)
+    bool indexing_{false};
+    std::mutex idx_mu_;
+    std::condition_variable idx_cv_;
+    std::vector<std::size_t> idx_staged_;
+    bool idx_done_{false};
+    std::jthread indexer_;
+
+    static void index_newlines(std::string_view bytes, std::size_t from, std::size_t to, std::vector<std::size_t>& out){
+        const char* base = bytes.data();
+        for (const char *p = base + from, *e = base + to;
+             p < e && (p = static_cast<const char*>(std::memchr(p, '\n', std::size_t(e - p)))) != nullptr; ++p)
+            out.push_back(std::size_t(p - base));
+    }
+    void stop_indexer(){
+        indexer_ = std::jthread();   // requests stop and joins
+        indexing_ = false; idx_done_ = false; idx_staged_.clear();
+    }
+    void clear_pieces(){
+        orig_.nl.clear(); add_.own.clear(); add_.nl.clear();
+        pieces_.clear();
+        size_ = lf_total_ = frontier_ = 0; crlf_ = false; valid_ = 0;
+    }
+    // grow the document over original bytes [frontier_, to); only ever
+    // appends at the end, because edits never reach past the frontier
+    void extend_original(std::size_t to){
+        if (to <= frontier_) return;
+        bool first_lf = (lf_total_ == 0);
+        Piece np{false, frontier_, to - frontier_, 0};
+        np.lf = count_lf(np);
+        if (!pieces_.empty() && !pieces_.back().add && pieces_.back().off + pieces_.back().len == frontier_) {
+            pieces_.back().len += np.len; pieces_.back().lf += np.lf;
+        } else pieces_.push_back(np);
+        valid_ = std::min(valid_, pieces_.size() - 1);
+        size_ += np.len; lf_total_ += np.lf; frontier_ = to;
+        if (first_lf && !orig_.nl.empty()) {
+            std::size_t nl = orig_.nl.front();
+            crlf_ = nl > 0 && orig_.bytes()[nl-1] == '\r';
+        }
+    }
+    const Source& source(const Piece& p) const { return p.add ? add_ : orig_; }
+    std::string_view view(const Piece& p) const { return source(p).bytes().substr(p.off, p.len); }
+    std::size_t count_lf(const Piece& p) const {
+        const auto& nl = source(p).nl;
+        return std::size_t(std::lower_bound(nl.begin(), nl.end(), p.off + p.len) - std::lower_bound(nl.begin(), nl.end(), p.off));
+    }
+    void sync() const {
+        pos_.resize(pieces_.size() + 1); lfs_.resize(pieces_.size() + 1);
+        if (valid_ == 0) { pos_[0] = 0; lfs_[0] = 0; }
+        for (std::size_t i = valid_; i < pieces_.size(); ++i) {
+            pos_[i+1] = pos_[i] + pieces_[i].len;
+            lfs_[i+1] = lfs_[i] + pieces_[i].lf;
+        }
+        valid_ = pieces_.size();
+    }
+    // piece index and offset inside it; a position on a boundary maps to the
+    // start of the following piece (or {pieces_.size(), 0} at end of text)
+    std::pair<std::size_t, std::size_t> locate(std::size_t pos) const {
+        sync();
+        if (pos >= size_) return {pieces_.size(), 0};
+        std::size_t i = std::size_t(std::upper_bound(pos_.begin(), pos_.begin() + (std::ptrdiff_t)pieces_.size(), pos) - pos_.begin()) - 1;
+        return {i, pos - pos_[i]};
+    }
+};
+
+// ============ background shell jobs ============
+// One child process with stdout+stderr on a pipe. A reader thread drains
+// the pipe into a shared chunk that the UI thread takes with poll(), so the
+// editor never blocks on the child. The child runs inside a job object:
+// cancel() kills it together with anything it spawned, which also closes
+// the pipe and lets the reader finish.
+
+class ShellJob {
+public:
+    ShellJob() = default;
+    ShellJob(const ShellJob&) = delete;
+    ShellJob& operator=(const ShellJob&) = delete;
+    ~ShellJob(){ cancel(); reader_ = std::jthread(); close_handles(); }
+
+    // with_stdin: keep a pipe to the child's stdin for send(); otherwise it reads NUL
+    bool start(const std::string& cmdline, bool with_stdin = false){
+        SECURITY_ATTRIBUTES sa{sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
+        HANDLE rd = nullptr, wr = nullptr;
+        if (!CreatePipe(&rd, &wr, &sa, 0)) return false;
+        SetHandleInformation(rd, HANDLE_FLAG_INHERIT, 0);
+        HANDLE nul = INVALID_HANDLE_VALUE, child_in = INVALID_HANDLE_VALUE;
+        if (with_stdin && CreatePipe(&child_in, &in_, &sa, 0)) SetHandleInformation(in_, HANDLE_FLAG_INHERIT, 0);
+        else child_in = nul = CreateFileA("NUL", GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr);
+        STARTUPINFOA si{}; si.cb = sizeof(si);
+        si.dwFlags = STARTF_USESTDHANDLES;
+        si.hStdInput = child_in; si.hStdOutput = wr; si.hStdError = wr;
+        PROCESS_INFORMATION pi{};
+        std::string cl = cmdline;   // CreateProcessA may modify the buffer
+        job_ = CreateJobObjectA(nullptr, nullptr);
+        if (job_) {
+            JOBOBJECT_EXTENDED_LIMIT_INFORMATION lim{};
+            lim.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+            SetInformationJobObject(job_, JobObjectExtendedLimitInformation, &lim, sizeof(lim));
+        }
+        BOOL ok = CreateProcessA(nullptr, cl.data(), nullptr, nullptr, TRUE,
+                                 CREATE_NO_WINDOW | CREATE_SUSPENDED, nullptr, nullptr, &si, &pi);
+        CloseHandle(wr);
+        if (child_in != INVALID_HANDLE_VALUE) CloseHandle(child_in);
+        if (!ok) { CloseHandle(rd); close_handles(); return false; }
+        if (job_) AssignProcessToJobObject(job_, pi.hProcess);
+        ResumeThread(pi.hThread); CloseHandle(pi.hThread);
+        proc_ = pi.hProcess;
+        running_ = true;
+        reader_ = std::jthread([this, rd]{
+            char buf[64 * 1024]; DWORD n = 0;
+            while (ReadFile(rd, buf, sizeof(buf), &n, nullptr) && n > 0) {
+                { std::lock_guard<std::mutex> lk(mu_); pending_.append(buf, n); }
+                wake_ui();
+            }
+            CloseHandle(rd);
+            WaitForSingleObject(proc_, INFINITE);
+            DWORD code = 0; GetExitCodeProcess(proc_, &code);
+            exit_code_ = (int)code;
+            running_ = false;
+            wake_ui();
+        });
+        return true;
+    }
+    // output produced since the last call (may be empty)
+    std::string poll(){
+        std::lock_guard<std::mutex> lk(mu_);
+        std::string out; out.swap(pending_);
+        return out;
+    }
+    // write to the child's stdin (start(..., true) only)
+    bool send(std::string_view s){
+        while (!s.empty() && in_) {
+            DWORD w = 0;
+            if (!WriteFile(in_, s.data(), (DWORD)std::min<std::size_t>(s.size(), std::size_t(1) << 20), &w, nullptr) || !w) return false;
+            s.remove_prefix(w);
+        }
+        return in_ != nullptr;
+    }
+    void cancel(){ if (running_ && job_) { cancelled_ = true; TerminateJobObject(job_, 1); } }
+    // block until the child has exited and its output is fully read
+    void wait(){ if (reader_.joinable()) reader_.join(); }
+    bool running() const { return running_; }
+    bool cancelled() const { return cancelled_; }
+    int exit_code() const { return exit_code_; }
+
+private:
+    HANDLE proc_{nullptr}, job_{nullptr}, in_{nullptr};
+    std::mutex mu_;
+    std::string pending_;
+    std::atomic<bool> running_{false}, cancelled_{false};
+    std::atomic<int> exit_code_{0};
+    std::jthread reader_;
+
+    void close_handles(){
+        if (proc_) CloseHandle(proc_);
+        if (job_) CloseHandle(job_);
+        if (in_) CloseHandle(in_);
+        proc_ = job_ = in_ = nullptr;
+    }
+};
+
+// Run a command line to completion without going through a shell; returns
+// everything it wrote to stdout and stderr.
+static std::string run_capture(const std::string& cmdline, int& exit_code) {
+    ShellJob job;
+    if (!job.start(cmdline)) { exit_code = -1; return "Error: could not start: " + cmdline; }
+    job.wait();
+    exit_code = job.exit_code();
+    return job.poll();
+}
+
+// ============ persistent C++ REPL ============
+// A long-lived clang-repl (or cling) fed over its stdin pipe, so repeated
+// evaluations skip process start-up and a cold compiler. Every snippet is
+// followed by a statement that prints MARK; output up to the marker belongs
+// to that snippet, which is how the editor knows it finished.
+
+class ReplSession {
+public:
+    bool start(const std::string& exe){
+        stop();
+        job_ = std::make_unique<ShellJob>();
+        if (!job_->start("\"" + exe + "\"", true)) { job_.reset(); return false; }
+        return job_->send("#include <cstdio>\n");
+    }
+    void stop(){ job_.reset(); carry_.clear(); outstanding_ = 0; }
+    bool alive() const { return job_ && job_->running(); }
+    bool busy() const { return alive() && outstanding_ > 0; }
+
+    bool eval(std::string_view snippet){
+        if (!alive()) return false;
+        std::string in = join_snippet(snippet);
+        in += "std::printf(\"\\n%s\\n\", \""; in += MARK; in += "\"); std::fflush(stdout);\n";
+        if (!job_->send(in)) return false;
+        outstanding_++;
+        return true;
+    }
+    // Output since the last call with prompts and markers removed. A tail
+    // that could be the start of a marker is held back until it resolves.
+    std::string poll(){
+        if (!job_) return {};
+        carry_ += job_->poll();
+        std::string out;
+        for (std::size_t at; (at = carry_.find(MARK)) != std::string::npos; ) {
+            out.append(carry_, 0, at);
+            std::size_t end = at + MARK.size();
+            if (end < carry_.size() && carry_[end] == '\r') end++;
+            if (end < carry_.size() && carry_[end] == '\n') end++;
+            carry_.erase(0, end);
+            if (outstanding_ > 0) outstanding_--;
+        }
+        std::size_t keep = std::min(carry_.size(), MARK.size() - 1);
+        out.append(carry_, 0, carry_.size() - keep);
+        carry_.erase(0, carry_.size() - keep);
+        if (!alive()) { out += carry_; carry_.clear(); outstanding_ = 0; }
+        for (std::string_view prompt : {"clang-repl> ", "[cling]$ ", "[cling]$"})
+            for (std::size_t at; (at = out.find(prompt)) != std::string::npos; ) out.erase(at, prompt.size());
+        return out;
+    }
+
+private:
+    static constexpr std::string_view MARK = "@@vimified-eval-done@@";
+
+    // Lines are joined with '\' continuations so the REPL takes the snippet
+    // as one input. Splicing happens before comments and directives are
+    // seen, so // comments are cut off first and a #directive always ends
+    // its input (a directive's own continuations are kept).
+    static std::string join_snippet(std::string_view snippet){
+        struct Line { std::string_view text; bool directive; };
+        std::vector<Line> lines;
+        bool in_block = false, in_directive = false;
+        while (!snippet.empty()) {
+            std::size_t nl = snippet.find('\n');
+            std::string_view line = snippet.substr(0, nl);
+            snippet.remove_prefix(nl == std::string_view::npos ? snippet.size() : nl + 1);
+            if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+            std::size_t first = line.find_first_not_of(" \t");
+            bool directive = in_directive || (!in_block && first != std::string_view::npos && line[first] == '#');
+            line = code_part(line, in_block);
+            in_directive = directive && !line.empty() && line.back() == '\\';
+            lines.push_back({line, directive});
+        }
+        std::string in;
+        for (std::size_t i = 0; i < lines.size(); ++i) {
+            in.append(lines[i].text);
+            bool join = !lines[i].directive && i + 1 < lines.size() && !lines[i + 1].directive
+                        && (lines[i].text.empty() || lines[i].text.back() != '\\');
+            in += join ? " \\\n" : "\n";
+        }
+        return in;
+    }
+    // the line without a trailing // comment; in_block carries an open /* across lines
+    static std::string_view code_part(std::string_view line, bool& in_block){
+        for (std::size_t i = 0; i < line.size(); ++i) {
+            char c = line[i];
+            if (in_block) { if (c == '*' && i + 1 < line.size() && line[i + 1] == '/') { in_block = false; ++i; } continue; }
+            if (c == '/' && i + 1 < line.size() && line[i + 1] == '/') return line.substr(0, i);
+            if (c == '/' && i + 1 < line.size() && line[i + 1] == '*') { in_block = true; ++i; continue; }
+            // quotes; a ' after a digit or letter is a digit separator
+            if (c == '"' || (c == '\'' && (i == 0 || !std::isalnum((unsigned char)line[i - 1])))) {
+                for (++i; i < line.size() && line[i] != c; ++i) if (line[i] == '\\') ++i;
+            }
+        }
+        return line;
+    }
+    std::unique_ptr<ShellJob> job_;
+    std::string carry_;
+    int outstanding_{0};
+};
+
+// ============ quickfix ============
+// Compiler diagnostics (g++/clang "file:line[:col]: severity: message").
+// The raw output is stored once and each entry is a small record of spans
+// into it. Complete lines are parsed as chunks stream in; a large batch is
+// split at newlines across the worker pool. Errors and warnings are also
+// indexed on their own, so stepping through them is O(1) per step.
+
+class QuickfixList {
+public:
+    enum Severity : std::uint8_t { SEV_NOTE, SEV_WARNING, SEV_ERROR };
+    struct Entry {
+        std::size_t file_off, msg_off;
+        std::uint32_t file_len, msg_len;
+        std::uint32_t line, col;          // 1-based; col 0 when the compiler gave none
+        Severity sev;
+    };
+
+    void reset(){ text_.clear(); entries_.clear(); jumps_.clear(); parsed_ = 0; cur_ = NONE; errors_ = warnings_ = 0; }
+    void feed(std::string_view chunk){
+        text_.append(chunk);
+        std::size_t nl = text_.rfind('\n');
+        if (nl != std::string::npos && nl + 1 > parsed_) parse_upto(nl + 1);
+    }
+    // end of output: parse a last line that had no newline
+    void finish(){ parse_upto(text_.size()); }
+
+    std::size_t size() const { return entries_.size(); }
+    std::size_t errors() const { return errors_; }
+    std::size_t warnings() const { return warnings_; }
+    const std::vector<Entry>& entries() const { return entries_; }
+    std::string_view file(const Entry& e) const { return std::string_view(text_).substr(e.file_off, e.file_len); }
+    std::string_view message(const Entry& e) const { return std::string_view(text_).substr(e.msg_off, e.msg_len); }
+    static const char* severity_name(Severity s){ return s == SEV_ERROR ? "error" : s == SEV_WARNING ? "warning" : "note"; }
+
+    // step through errors and warnings (notes are skipped); nullptr past either end
+    const Entry* next(){ if (cur_ == NONE ? jumps_.empty() : cur_ + 1 >= jumps_.size()) return nullptr; cur_ = (cur_ == NONE) ? 0 : cur_ + 1; return current(); }
+    const Entry* prev(){ if (cur_ == NONE || cur_ == 0) return nullptr; --cur_; return current(); }
+    const Entry* current() const { return cur_ == NONE ? nullptr : &entries_[jumps_[cur_]]; }
+    std::size_t current_index() const { return cur_ == NONE ? NONE : jumps_[cur_]; }
+
+private:
+    static constexpr std::size_t NONE = (std::numeric_limits<std::size_t>::max)();
+    static constexpr std::size_t PARALLEL_BYTES = std::size_t(1) << 20;
+    std::string text_;
+    std::vector<Entry> entries_;
+    std::vector<std::size_t> jumps_;      // indices of non-note entries
+    std::size_t parsed_{0}, cur_{NONE}, errors_{0}, warnings_{0};
+
+    void parse_upto(std::size_t end){
+        std::size_t n = end - parsed_;
+        std::vector<std::vector<Entry>> part;
+        if (n < PARALLEL_BYTES) { part.resize(1); parse_range(parsed_, end, part[0]); }
+        else {
+            std::vector<std::size_t> cut{parsed_};
+            std::size_t slices = std::min<std::size_t>(worker_count() * 2, n / (PARALLEL_BYTES / 4));
+            for (std::size_t k = 1; k < slices; ++k) {
+                std::size_t b = text_.find('\n', parsed_ + n * k / slices);
+                if (b == std::string::npos || b + 1 >= end) break;
+                if (b + 1 > cut.back()) cut.push_back(b + 1);
+            }
+            cut.push_back(end);
+            part.resize(cut.size() - 1);
+            parallel_for(part.size(), [&](std::size_t i){ parse_range(cut[i], cut[i+1], part[i]); });
+        }
+        for (auto& p : part)
+            for (auto& e : p) {
+                if (e.sev == SEV_ERROR) errors_++;
+                if (e.sev == SEV_WARNING) warnings_++;
+                if (e.sev != SEV_NOTE) jumps_.push_back(entries_.size());
+                entries_.push_back(e);
+            }
+        parsed_ = end;
+    }
+    void parse_range(std::size_t from, std::size_t to, std::vector<Entry>& out) const {
+        while (from < to) {
+            std::size_t nl = text_.find('\n', from);
+            std::size_t e = (nl == std::string::npos || nl >= to) ? to : nl;
+            if (auto ent = parse_line(from, e)) out.push_back(*ent);
+            from = e + 1;
+        }
+    }
+    std::optional<Entry> parse_line(std::size_t off, std::size_t end) const {
+        std::string_view line = std::string_view(text_).substr(off, end - off);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        auto digits = [&](std::size_t& q, std::uint32_t& v){
+            std::size_t q0 = q; v = 0;
+            while (q < line.size() && line[q] >= '0' && line[q] <= '9') v = v * 10 + std::uint32_t(line[q++] - '0');
+            return q > q0;
+        };
+        // the file name may itself hold colons (C:\...), so try each one
+        for (std::size_t p = line.find(':'); p != std::string_view::npos && p > 0; p = line.find(':', p + 1)) {
+            std::size_t q = p + 1; std::uint32_t ln = 0, col = 0;
+            if (!digits(q, ln) || q >= line.size() || line[q] != ':') continue;
+            q++;
+            std::size_t q2 = q;
+            if (digits(q2, col) && q2 < line.size() && line[q2] == ':') q = q2 + 1; else col = 0;
+            while (q < line.size() && line[q] == ' ') q++;
+            std::string_view rest = line.substr(q);
+            Severity sev;
+            std::size_t skip;
+            if (rest.starts_with("fatal error:")) { sev = SEV_ERROR; skip = 12; }
+            else if (rest.starts_with("error:")) { sev = SEV_ERROR; skip = 6; }
+            else if (rest.starts_with("warning:")) { sev = SEV_WARNING; skip = 8; }
+            else if (rest.starts_with("note:")) { sev = SEV_NOTE; skip = 5; }
+            else continue;
+            std::size_t m = q + skip;
+            while (m < line.size() && line[m] == ' ') m++;
+            return Entry{off, off + m, (std::uint32_t)p, (std::uint32_t)(line.size() - m), ln, col, sev};
+        }
+        return std::nullopt;
+    }
+};
+
+// ============ undo ============
+// Edit journal. A record is the byte delta of one change: where it happened,
+// what came out and what went in. The bytes sit back to back in one arena
+// string, so the journal grows with the edits, never with the document, and
+// undo/redo costs O(edit size). Runs of typed characters fold into the
+// record they extend.
+
+class UndoLog {
+public:
+    struct Change { std::size_t pos; std::string_view removed, inserted; };
+
+    void clear(){ arena_.clear(); ops_.clear(); done_ = 0; open_ = false; }
+    // `removed` was replaced by `inserted` at pos; typing=true lets a
+    // following keystroke at the end of this one extend it
+    void record(std::size_t pos, std::string_view removed, std::string_view inserted, bool typing = false){
+        if (done_ < ops_.size()) { arena_.resize(ops_[done_].data); ops_.resize(done_); }   // drop redo tail
+        if (typing && open_) {
+            Op& o = ops_.back();
+            if (!o.del_len && removed.empty() && o.pos + o.ins_len == pos) {
+                arena_.append(inserted); o.ins_len += inserted.size(); return;
+            }
+        }
+        ops_.push_back({pos, arena_.size(), removed.size(), inserted.size()});
+        arena_.append(removed); arena_.append(inserted);
+        done_ = ops_.size(); open_ = typing;
+    }
+    void seal(){ open_ = false; }    // the next keystroke starts a new step
+    // see PieceTable::reserve_edits
+    void reserve_edits(std::size_t bytes, std::size_t ops){ reserve_ahead(arena_, bytes); reserve_ahead(ops_, ops); }
+    // the change to revert / reapply; views stay valid until the next record()
+    std::optional<Change> undo(){
+        if (!done_) return std::nullopt;
+        open_ = false;
+        return change(ops_[--done_]);
+    }
+    std::optional<Change> redo(){
+        if (done_ == ops_.size()) return std::nullopt;
+        return change(ops_[done_++]);
+    }
+    std::size_t steps() const { return done_; }
+    std::size_t bytes() const { return arena_.size() + ops_.size() * sizeof(Op); }
+
+private:
+    struct Op { std::size_t pos, data, del_len, ins_len; };   // data: removed bytes, then inserted
+    std::string arena_;
+    std::vector<Op> ops_;
+    std::size_t done_{0};            // ops_[0, done_) are applied
+    bool open_{false};
+
+    Change change(const Op& o) const {
+        std::string_view a(arena_);
+        return {o.pos, a.substr(o.data, o.del_len), a.substr(o.data + o.del_len, o.ins_len)};
+    }
+};
+
+// ============ swap file ============
+// Crash journal of one buffer, next to its file (".name.swp", as vim names
+// them): the stamp of the saved file it applies to, then one record per
+// splice with its position, the length removed, the bytes inserted and a
+// checksum. The editor only queues records; a writer thread appends them
+// and group-commits: one fsync covers everything queued within
+// COMMIT_INTERVAL, so durability costs O(edit) I/O and never stalls a key.
+// Recovery replays the records up to the first torn or corrupt one.
+
+struct SwapFileHeader {
+    char magic[8];                      // "VIMSWAP1"
+    std::uint64_t base_size, base_mtime;
+};
+struct SwapRecord { std::uint64_t pos, del_len, ins_len, check; };   // then ins_len bytes
+
+class SwapFile {
+public:
+    static constexpr auto COMMIT_INTERVAL = std::chrono::milliseconds(100);
+    struct Edit { std::size_t pos, del_len; std::string_view inserted; std::size_t end; };   // end: file offset after it
+    struct Journal {
+        FileStamp base;
+        std::string bytes;              // the whole swap file; edits view into it
+        std::vector<Edit> edits;
+    };
+
+    static std::string path_for(const std::string& file){
+        std::size_t cut = file.find_last_of("/\\");
+        cut = cut == std::string::npos ? 0 : cut + 1;
+        return file.substr(0, cut) + "." + file.substr(cut) + ".swp";
+    }
+    // the intact records of the swap file at path, or nullopt if there is none
+    static std::optional<Journal> read(const std::string& path){
+        auto s = read_text_file(path);
+        if (!s || s->size() < sizeof(SwapFileHeader) || s->compare(0, sizeof(MAGIC), MAGIC, sizeof(MAGIC))) return std::nullopt;
+        Journal j; j.bytes = std::move(*s);
+        SwapFileHeader h; std::memcpy(&h, j.bytes.data(), sizeof h);
+        j.base = {h.base_size, h.base_mtime};
+        for (std::size_t at = sizeof h; j.bytes.size() - at >= sizeof(SwapRecord); ) {
+            SwapRecord r; std::memcpy(&r, j.bytes.data() + at, sizeof r);
+            if (r.ins_len > j.bytes.size() - at - sizeof r) break;
+            std::string_view ins = std::string_view(j.bytes).substr(at + sizeof r, (std::size_t)r.ins_len);
+            if (checksum(r, ins) != r.check) break;
+            at += sizeof r + ins.size();
+            j.edits.push_back({(std::size_t)r.pos, (std::size_t)r.del_len, ins, at});
+        }
+        return j;
+    }
+
+    SwapFile(std::string path, FileStamp base): path_(std::move(path)), base_(base) {}
+    SwapFile(const SwapFile&) = delete;
+    SwapFile& operator=(const SwapFile&) = delete;
+    // stops the writer once the queue is on disk; the file stays, as after a crash
+    ~SwapFile(){ stop(); }
+
+    const std::string& path() const { return path_; }
+    // A journal left by a crashed session sits at path(): record nothing
+    // and leave it alone until it is recovered or discarded.
+    void hold(){ held_ = true; }
+    void release(){ held_ = false; }
+    bool held() const { return held_; }
+    // continue the held journal after its first `valid` bytes were replayed
+    void resume(std::size_t valid){ held_ = false; resume_at_ = valid; }
+    // Queue one splice; the file and its writer start with the first one.
+    // False once the swap file cannot be written.
+    bool append(std::size_t pos, std::size_t del_len, std::string_view ins){
+        if (held_) return true;
+        if (failed_) return false;
+        if (!writer_.joinable() && !start()) return false;
+        SwapRecord r{pos, del_len, ins.size(), 0};
+        r.check = checksum(r, ins);
+        {
+            std::lock_guard lk(mu_);
+            queue_.append(reinterpret_cast<const char*>(&r), sizeof r).append(ins);
+        }
+        cv_.notify_one();
+        return !failed_;
+    }
+    // commit now and wait until everything queued is on disk
+    bool sync(){
+        std::unique_lock lk(mu_);
+        urgent_ = true; cv_.notify_one();
+        idle_.wait(lk, [&]{ return failed_ || !writer_.joinable() || (queue_.empty() && !writing_); });
+        urgent_ = false;
+        return !failed_;
+    }
+    // the edits are saved or abandoned: stop and delete the file (a held one is kept)
+    void discard(){
+        stop();
+        if (!held_) DeleteFileA(path_.c_str());
+        resume_at_ = 0; failed_ = false;
+    }
+
+private:
+    static constexpr char MAGIC[8] = {'V','I','M','S','W','A','P','1'};
+    std::string path_;
+    FileStamp base_;
+    bool held_{false};
+    std::size_t resume_at_{0};
+    HANDLE h_{INVALID_HANDLE_VALUE};
+    std::thread writer_;
+    std::mutex mu_;
+    std::condition_variable cv_, idle_;
+    std::string queue_;                 // records not yet handed to the writer
+    bool stop_{false}, urgent_{false}, writing_{false};
+    std::atomic<bool> failed_{false};
+
+    static std::uint64_t checksum(const SwapRecord& r, std::string_view ins){
+        const std::uint64_t f[3] = {r.pos, r.del_len, r.ins_len};
+        return fnv1a64(fnv1a64(FNV1A64_OFFSET, std::string_view(reinterpret_cast<const char*>(f), sizeof f)), ins);
+    }
+    bool start(){
+        if (resume_at_) {
+            h_ = CreateFileA(path_.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            LARGE_INTEGER at; at.QuadPart = (LONGLONG)resume_at_;
+            if (h_ != INVALID_HANDLE_VALUE && !(SetFilePointerEx(h_, at, nullptr, FILE_BEGIN) && SetEndOfFile(h_))) { CloseHandle(h_); h_ = INVALID_HANDLE_VALUE; }
+        } else {
+            h_ = CreateFileA(path_.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_HIDDEN, nullptr);
+            SwapFileHeader h; std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+            h.base_size = base_.size; h.base_mtime = base_.mtime;
+            queue_.assign(reinterpret_cast<const char*>(&h), sizeof h);   // goes out with the first group
+        }
+        if (h_ == INVALID_HANDLE_VALUE) { failed_ = true; queue_.clear(); return false; }
+        writer_ = std::thread([this]{ run(); });
+        return true;
+    }
+    void stop(){
+        if (!writer_.joinable()) return;
+        { std::lock_guard lk(mu_); stop_ = true; }
+        cv_.notify_one();
+        writer_.join();
+        CloseHandle(h_); h_ = INVALID_HANDLE_VALUE;
+        stop_ = false;
+    }
+    void run(){
+        std::string batch;
+        auto last = std::chrono::steady_clock::now() - COMMIT_INTERVAL;
+        std::unique_lock lk(mu_);
+        for (;;) {
+            cv_.wait(lk, [&]{ return stop_ || !queue_.empty(); });
+            if (queue_.empty()) break;   // stopping with nothing left
+            // records arriving until the interval is up share this fsync
+            cv_.wait_until(lk, last + COMMIT_INTERVAL, [&]{ return stop_ || urgent_; });
+            batch.swap(queue_); writing_ = true;
+            lk.unlock();
+            bool ok = write_all(batch) && FlushFileBuffers(h_);
+            batch.clear(); last = std::chrono::steady_clock::now();
+            lk.lock();
+            writing_ = false;
+            if (!ok) { failed_ = true; queue_.clear(); }
+            idle_.notify_all();
+        }
+    }
+    bool write_all(std::string_view s){
+        while (!s.empty()) {
+            DWORD n = (DWORD)std::min<std::size_t>(s.size(), std::size_t(1) << 30), w = 0;
+            if (!WriteFile(h_, s.data(), n, &w, nullptr) || w == 0) return false;
+            s.remove_prefix(w);
+        }
+        return true;
+    }
+};
+
+// ============ search ============
+// Patterns are line-oriented: nothing matches across '\n'. A pattern
+// without regex operators (after unescaping) is searched as a literal:
+// memchr on its first byte for short needles, Boyer-Moore-Horspool for
+// longer ones. Anything else compiles to a small NFA program run as a
+// Pike VM, which is linear in the text for every pattern (no
+// backtracking). Supported syntax: . [] [^] a-z ranges, * + ? (and the
+// lazy *? +? ??), |, ( ),
+// ^ $, and \d \w \s \D \W \S plus escaped metacharacters.
+
+class SearchPattern {
+public:
+    using Match = std::pair<std::size_t, std::size_t>;   // offset, length
+    static constexpr std::size_t NONE = std::string_view::npos;
+
+    // per-thread working memory for the VM
+    struct Scratch {
+        std::vector<std::pair<std::uint32_t, std::size_t>> cur, next;   // (pc, match start)
+        std::vector<std::uint32_t> mark;
+        std::uint32_t gen{0};
+    };
+
+    bool compile(std::string_view pat, std::string& err){
+        prog_.clear(); classes_.clear(); literal_.clear();
+        src_ = pat; at_ = 0; err_.clear();
+        if (pat.empty()) { err = "empty pattern"; return false; }
+        Node root = parse_alt();
+        if (err_.empty() && at_ < src_.size()) err_ = "unmatched )";
+        if (!err_.empty()) { err = err_; return false; }
+        emit(root);
+        prog_.push_back({MATCH, 0, 0});
+        // a plain chain of characters is a literal
+        is_literal_ = std::all_of(prog_.begin(), prog_.end() - 1, [](const Inst& i){ return i.op == CHAR; });
+        if (is_literal_) {
+            for (std::size_t i = 0; i + 1 < prog_.size(); ++i) literal_.push_back((char)prog_[i].x);
+            std::fill(std::begin(skip_), std::end(skip_), literal_.size());
+            for (std::size_t i = 0; i + 1 < literal_.size(); ++i) skip_[(unsigned char)literal_[i]] = literal_.size() - 1 - i;
+        }
+        compute_first();
+        return true;
+    }
+    bool literal() const { return is_literal_; }
+    std::string_view literal_text() const { return literal_; }
+
+    // leftmost non-empty match starting at or after `from`; {NONE, 0} if none
+    Match find(std::string_view text, std::size_t from, Scratch& s) const {
+        return is_literal_ ? find_literal(text, from) : find_vm(text, from, s);
+    }
+
+private:
+    enum Op : std::uint8_t { CHAR, ANY, CLASS, SPLIT, JMP, BOL, EOL, MATCH };
+    struct Inst { Op op; std::uint32_t x, y; };   // CHAR: x=byte; CLASS: x=index; SPLIT: x,y; JMP: x
+    using ByteSet = std::array<bool, 256>;
+
+    struct Node {
+        enum Kind { EMPTY, BYTE, SET, DOT, START, END, CAT, ALT, STAR, PLUS, QUEST } kind{EMPTY};
+        std::uint32_t v{0};
+        std::vector<Node> kids;
+    };
+
+    std::vector<Inst> prog_;
+    std::vector<ByteSet> classes_;
+    std::string literal_;
+    bool is_literal_{false};
+    std::size_t skip_[256]{};
+    ByteSet first_{};              // bytes that can start a match
+    bool first_any_{true};         // no usable first-byte filter
+    std::string_view src_;
+    std::size_t at_{0};
+    std::string err_;
+
+    // ---- parser: alt := cat ('|' cat)*; cat := rep*; rep := atom [*+?]* ----
+    bool more() const { return at_ < src_.size(); }
+    Node parse_alt(){
+        Node left = parse_cat();
+        while (more() && src_[at_] == '|') {
+            at_++;
+            Node alt{Node::ALT, 0, {}};
+            alt.kids.push_back(std::move(left)); alt.kids.push_back(parse_cat());
+            left = std::move(alt);
+        }
+        return left;
+    }
+    Node parse_cat(){
+        Node cat{Node::CAT, 0, {}};
+        while (more() && src_[at_] != '|' && src_[at_] != ')' && err_.empty()) {
+            Node a = parse_atom();
+            while (more() && (src_[at_] == '*' || src_[at_] == '+' || src_[at_] == '?')) {
+                Node r{src_[at_] == '*' ? Node::STAR : src_[at_] == '+' ? Node::PLUS : Node::QUEST, 0, {}};
+                r.kids.push_back(std::move(a)); at_++;
+                if (more() && src_[at_] == '?') { r.v = 1; at_++; }   // lazy: prefer fewer repetitions
+                a = std::move(r);
+            }
+            cat.kids.push_back(std::move(a));
+        }
+        return cat;
+    }
+    Node set_node(const ByteSet& b){ classes_.push_back(b); classes_.back()[(unsigned char)'\n'] = false; return {Node::SET, (std::uint32_t)(classes_.size() - 1), {}}; }
+    static bool class_escape(char c, ByteSet& b){
+        b.fill(false);
+        bool neg = std::isupper((unsigned char)c) != 0;
+        char k = (char)std::tolower((unsigned char)c);
+        if (k != 'd' && k != 'w' && k != 's') return false;
+        for (int i = 0; i < 256; ++i) {
+            bool in = k == 'd' ? (i >= '0' && i <= '9') : k == 'w' ? WORD_BYTE[(std::size_t)i] : (i == ' ' || (i >= '\t' && i <= '\r'));
+            b[(std::size_t)i] = in != neg;
+        }
+        return true;
+    }
+    Node parse_atom(){
+        char c = src_[at_++];
+        ByteSet b;
+        switch (c) {
+            case '(': {
+                Node inner = parse_alt();
+                if (!more() || src_[at_] != ')') { err_ = "missing )"; return {}; }
+                at_++;
+                return inner;
+            }
+            case '*': case '+': case '?': err_ = "nothing to repeat"; return {};
+            case '.': return {Node::DOT, 0, {}};
+            case '^': return {Node::START, 0, {}};
+            case '$': return {Node::END, 0, {}};
+            case '[': return parse_class();
+            case '\\':
+                if (!more()) { err_ = "trailing \\"; return {}; }
+                c = src_[at_++];
+                if (class_escape(c, b)) return set_node(b);
+                if (c == 't') c = '\t';
+                return {Node::BYTE, (unsigned char)c, {}};
+            default: return {Node::BYTE, (unsigned char)c, {}};
+        }
+    }
+    Node parse_class(){
+        ByteSet b{}; bool neg = false;
+        if (more() && src_[at_] == '^') { neg = true; at_++; }
+        bool first = true;
+        while (more() && (src_[at_] != ']' || first)) {
+            first = false;
+            unsigned char lo = (unsigned char)src_[at_++];
+            if (lo == '\\' && more()) {
+                ByteSet e;
+                if (class_escape(src_[at_], e)) { at_++; for (int i = 0; i < 256; ++i) b[(std::size_t)i] = b[(std::size_t)i] || e[(std::size_t)i]; continue; }
+                lo = (unsigned char)src_[at_++];
+                if (lo == 't') lo = '\t';
+            }
+            unsigned char hi = lo;
+            if (at_ + 1 < src_.size() && src_[at_] == '-' && src_[at_+1] != ']') { hi = (unsigned char)src_[at_+1]; at_ += 2; }
+            for (unsigned v = lo; v <= hi; ++v) b[v] = true;
+        }
+        if (!more()) { err_ = "missing ]"; return {}; }
+        at_++;
+        if (neg) for (auto& x : b) x = !x;
+        return set_node(b);
+    }
+
+    // ---- code generation (Thompson construction) ----
+    std::uint32_t pc() const { return (std::uint32_t)prog_.size(); }
+    void emit(const Node& n){
+        switch (n.kind) {
+            case Node::EMPTY: break;
+            case Node::BYTE:  prog_.push_back({CHAR, n.v, 0}); break;
+            case Node::SET:   prog_.push_back({CLASS, n.v, 0}); break;
+            case Node::DOT:   prog_.push_back({ANY, 0, 0}); break;
+            case Node::START: prog_.push_back({BOL, 0, 0}); break;
+            case Node::END:   prog_.push_back({EOL, 0, 0}); break;
+            case Node::CAT:   for (auto& k : n.kids) emit(k); break;
+            case Node::ALT: {
+                std::uint32_t split = pc(); prog_.push_back({SPLIT, split + 1, 0});
+                emit(n.kids[0]);
+                std::uint32_t jmp = pc(); prog_.push_back({JMP, 0, 0});
+                prog_[split].y = pc();
+                emit(n.kids[1]);
+                prog_[jmp].x = pc();
+                break;
+            }
+            case Node::STAR: {
+                std::uint32_t split = pc(); prog_.push_back({SPLIT, split + 1, 0});
+                emit(n.kids[0]);
+                prog_.push_back({JMP, split, 0});
+                prog_[split].y = pc();
+                if (n.v) std::swap(prog_[split].x, prog_[split].y);
+                break;
+            }
+            case Node::PLUS: {
+                std::uint32_t top = pc();
+                emit(n.kids[0]);
+                prog_.push_back({SPLIT, top, pc() + 1});
+                if (n.v) std::swap(prog_.back().x, prog_.back().y);
+                break;
+            }
+            case Node::QUEST: {
+                std::uint32_t split = pc(); prog_.push_back({SPLIT, split + 1, 0});
+                emit(n.kids[0]);
+                prog_[split].y = pc();
+                if (n.v) std::swap(prog_[split].x, prog_[split].y);
+                break;
+            }
+        }
+    }
+    // bytes that can begin a match, found by following the start closure
+    void compute_first(){
+        first_.fill(false); first_any_ = false;
+        std::vector<bool> seen(prog_.size(), false);
+        std::vector<std::uint32_t> stack{0};
+        while (!stack.empty() && !first_any_) {
+            std::uint32_t p = stack.back(); stack.pop_back();
+            if (seen[p]) continue;
+            seen[p] = true;
+            const Inst& i = prog_[p];
+            switch (i.op) {
+                case CHAR:  first_[i.x] = true; break;
+                case CLASS: for (std::size_t c = 0; c < 256; ++c) first_[c] = first_[c] || classes_[i.x][c]; break;
+                case SPLIT: stack.push_back(i.x); stack.push_back(i.y); break;
+                case JMP:   stack.push_back(i.x); break;
+                default:    first_any_ = true;   // ANY, anchors, or an empty match path
+            }
+        }
+    }
+
+    Match find_literal(std::string_view text, std::size_t from) const {
+        const std::size_t m = literal_.size(), n = text.size();
+        if (m > n) return {NONE, 0};
+        const char* t = text.data();
+        if (m < 4) {
+            for (std::size_t i = from; i + m <= n;) {
+                const void* p = std::memchr(t + i, literal_[0], n - m + 1 - i);
+                if (!p) break;
+                i = std::size_t(static_cast<const char*>(p) - t);
+                if (std::memcmp(t + i, literal_.data(), m) == 0) return {i, m};
+                ++i;
+            }
+            return {NONE, 0};
+        }
+        for (std::size_t i = from; i + m <= n; i += skip_[(unsigned char)t[i + m - 1]])
+            if (t[i + m - 1] == literal_[m - 1] && std::memcmp(t + i, literal_.data(), m - 1) == 0) return {i, m};
+        return {NONE, 0};
+    }
+
+    bool at_eol(std::string_view t, std::size_t i) const {
+        return i == t.size() || t[i] == '\n' || (t[i] == '\r' && (i + 1 == t.size() || t[i+1] == '\n'));
+    }
+    // follow SPLIT / JMP / assertions from pc at position i, appending runnable threads in priority order
+    void add_thread(Scratch& s, std::vector<std::pair<std::uint32_t, std::size_t>>& list, std::uint32_t p,
+                    std::size_t start, std::string_view t, std::size_t i) const {
+        if (s.mark[p] == s.gen) return;
+        s.mark[p] = s.gen;
+        const Inst& in = prog_[p];
+        switch (in.op) {
+            case JMP:   add_thread(s, list, in.x, start, t, i); break;
+            case SPLIT: add_thread(s, list, in.x, start, t, i); add_thread(s, list, in.y, start, t, i); break;
+            case BOL:   if (i == 0 || t[i-1] == '\n') add_thread(s, list, p + 1, start, t, i); break;
+            case EOL:   if (at_eol(t, i)) add_thread(s, list, p + 1, start, t, i); break;
+            default:    list.emplace_back(p, start);
+        }
+    }
+    Match find_vm(std::string_view t, std::size_t from, Scratch& s) const {
+        s.mark.assign(prog_.size(), 0); s.gen = 1;
+        s.cur.clear(); s.next.clear();
+        Match best{NONE, 0};
+        // with nothing in flight, jump ahead to a byte that can start a match
+        auto skip = [&](std::size_t i){ if (!first_any_) while (i < t.size() && !first_[(unsigned char)t[i]]) ++i; return i; };
+        std::size_t i = skip(from);
+        if (i == t.size() && !first_any_) return best;
+        add_thread(s, s.cur, 0, i, t, i);
+        for (;; ++i) {
+            ++s.gen; s.next.clear();
+            unsigned char c = i < t.size() ? (unsigned char)t[i] : 0;
+            bool live = i < t.size() && c != '\n';
+            for (auto [p, start] : s.cur) {
+                const Inst& in = prog_[p];
+                if (in.op == MATCH) {
+                    if (i > start) { best = {start, i - start}; break; }   // cuts the lower-priority threads
+                    continue;
+                }
+                bool ok = live && (in.op == ANY || (in.op == CHAR && c == in.x) || (in.op == CLASS && classes_[in.x][c]));
+                if (ok) add_thread(s, s.next, p + 1, start, t, i + 1);
+            }
+            if (i >= t.size()) break;
+            if (best.first == NONE) {
+                // a match starting at i+1 has the lowest priority
+                std::size_t j = s.next.empty() ? skip(i + 1) : i + 1;
+                if (s.next.empty() && j == t.size() && !first_any_) break;
+                if (j != i + 1) ++s.gen;
+                add_thread(s, s.next, 0, j, t, j);
+                i = j - 1;
+            }
+            std::swap(s.cur, s.next);
+            if (s.cur.empty() && best.first != NONE) break;
+        }
+        return best;
+    }
+};
+
+// Per-unit sets of hashed byte trigrams. A literal can only occur in a unit
+// whose set holds every trigram of the literal, so repeated searches skip
+// most of a large file. Units are the same line-aligned runs searches use.
+// An edit marks only the units it touches; the others shift with it and
+// keep their sets, so the next search re-hashes just the edited stretch.
+class TrigramIndex {
+public:
+    static constexpr std::size_t BITS = std::size_t(1) << 17;   // per unit (16 KiB)
+    struct Span { std::size_t off, len; bool dirty; };
+
+    void clear(){ spans_.clear(); sets_.clear(); }
+    bool built() const { return !spans_.empty(); }
+    std::size_t bytes() const { return sets_.size() * BITS / 8; }
+    const std::vector<Span>& spans() const { return spans_; }
+    // adopt `units` as the index; sets of clean spans they repeat are kept
+    template <class Units> void build(const Units& units){
+        std::vector<Span> spans(units.size());
+        std::vector<std::vector<std::uint64_t>> sets(units.size());
+        std::vector<std::size_t> todo;
+        for (std::size_t u = 0, j = 0; u < units.size(); ++u) {
+            spans[u] = {units[u].off, units[u].text.size(), false};
+            while (j < spans_.size() && spans_[j].off < units[u].off) ++j;
+            if (j < spans_.size() && !spans_[j].dirty && spans_[j].off == spans[u].off && spans_[j].len == spans[u].len) sets[u] = std::move(sets_[j]);
+            else todo.push_back(u);
+        }
+        parallel_for(todo.size(), [&](std::size_t k){
+            auto& b = sets[todo[k]];
+            b.assign(BITS / 64, 0);
+            std::string_view t = units[todo[k]].text;
+            for (std::size_t i = 0; i + 3 <= t.size(); ++i) { std::size_t h = slot(t.data() + i); b[h >> 6] |= std::uint64_t(1) << (h & 63); }
+        });
+        spans_ = std::move(spans); sets_ = std::move(sets);
+    }
+    // [pos, pos+removed) became `added` bytes: the spans it reaches merge into
+    // one dirty span, the later ones shift
+    void edited(std::size_t pos, std::size_t removed, std::size_t added){
+        if (spans_.empty()) return;
+        std::size_t a = 0, b;
+        while (a + 1 < spans_.size() && spans_[a].off + spans_[a].len <= pos) ++a;
+        for (b = a + 1; b < spans_.size() && spans_[b].off < pos + removed; ++b) {}
+        spans_[a].len = spans_[b - 1].off + spans_[b - 1].len + added - removed - spans_[a].off;
+        spans_[a].dirty = true;
+        spans_.erase(spans_.begin() + (std::ptrdiff_t)(a + 1), spans_.begin() + (std::ptrdiff_t)b);
+        sets_.erase(sets_.begin() + (std::ptrdiff_t)(a + 1), sets_.begin() + (std::ptrdiff_t)b);
+        for (std::size_t k = a + 1; k < spans_.size(); ++k) spans_[k].off += added - removed;
+        if (!spans_[a].len) { spans_.erase(spans_.begin() + (std::ptrdiff_t)a); sets_.erase(sets_.begin() + (std::ptrdiff_t)a); }
+    }
+    bool may_contain(std::size_t unit, std::string_view lit) const {
+        const auto& b = sets_[unit];
+        for (std::size_t i = 0; i + 3 <= lit.size(); ++i) { std::size_t h = slot(lit.data() + i); if (!(b[h >> 6] >> (h & 63) & 1)) return false; }
+        return true;
+    }
 
-static double shannon_entropy_tokens(const std::unordered_map<std::string, std::size_t>& counts, std::size_t total) {
-    if (!total) return 0.0;
-    double H = 0.0;
-    for (auto& [t, n] : counts) {
-        if (n) {
-            double p = double(n) / double(total);
-            H -= p * std::log2(p);
-        }
+private:
+    std::vector<Span> spans_;
+    std::vector<std::vector<std::uint64_t>> sets_;
+    static std::size_t slot(const char* p){
+        std::uint64_t v = (std::uint64_t)(unsigned char)p[0] << 16 | (std::uint64_t)(unsigned char)p[1] << 8 | (unsigned char)p[2];
+        return std::size_t(mix64(v) & (BITS - 1));
     }
-    return H;
-}
+};
 
-static TokenStats compute_token_stats(const std::string& content) {
-    TokenStats st{}; st.lines = 1;
-    std::unordered_map<char, std::size_t> charfreq;
-    for (unsigned char c : content) {
-        st.chars++; charfreq[(char)c]++;
-        if (c=='\n') st.lines++;
-        if (std::isdigit(c)) st.digits++;
-        else if (std::isalpha(c)) st.letters++;
-        else if (std::isspace(c)) st.whitespace++;
-        else st.punctuation++;
+// all matches (non-overlapping, left to right) in one unit, as document offsets
+static void search_unit(const SearchPattern& pat, std::size_t base, std::string_view text,
+                        SearchPattern::Scratch& s, std::vector<SearchPattern::Match>& out) {
+    for (std::size_t from = 0; from < text.size();) {
+        auto [at, len] = pat.find(text, from, s);
+        if (at == SearchPattern::NONE) break;
+        out.emplace_back(base + at, len);
+        from = at + len;
     }
-    auto toks = tokenize_words(content); st.tokens = toks.size();
-    std::size_t totlen=0; for (auto& t: toks){ totlen += t.size(); st.freq[t]++; }
-    st.unique_tokens = st.freq.size();
-    st.ttr = st.tokens? double(st.unique_tokens)/double(st.tokens) : 0.0;
-    st.avg_token_len = st.tokens? double(totlen)/double(st.tokens) : 0.0;
-    st.char_entropy  = shannon_entropy(charfreq, st.chars);
-    st.token_entropy = shannon_entropy_tokens(st.freq, st.tokens);
-    return st;
 }
 
-static std::vector<std::pair<std::vector<std::string>, std::size_t>>
-top_ngrams(const std::vector<std::string>& toks, std::size_t n, std::size_t topk) {
-    std::map<std::vector<std::string>, std::size_t> counts;
-    if (!n || toks.size() < n) return {};
-    for (std::size_t i = 0; i + n <= toks.size(); ++i) {
-        std::vector<std::string> key;
-        key.reserve(n);
-        for (std::size_t j = 0; j < n; ++j) {
-            key.push_back(toks[i + j]);
+// Background search over line-aligned units on the worker pool. Units are
+// claimed in order and their matches published in order, so the UI can
+// show the first results while the rest of the file is still scanned.
+class SearchJob {
+public:
+    struct Unit { std::size_t off; std::string_view text; };
+    using Match = SearchPattern::Match;
+
+    SearchJob() = default;
+    SearchJob(const SearchJob&) = delete;
+    SearchJob& operator=(const SearchJob&) = delete;
+    ~SearchJob(){ cancel(); }
+
+    // `owned` keeps copied units alive; the rest must outlive the job
+    void start(std::shared_ptr<const SearchPattern> pat, std::vector<Unit> units, std::deque<std::string> owned){
+        cancel();
+        pat_ = std::move(pat); units_ = std::move(units); owned_ = std::move(owned);
+        results_.assign(units_.size(), {});
+        done_ = std::make_unique<std::atomic<bool>[]>(units_.size());
+        next_ = 0; published_ = 0;
+        std::size_t threads = std::min<std::size_t>(worker_count(), std::max<std::size_t>(1, units_.size()));
+        for (std::size_t t = 0; t < threads; ++t)
+            workers_.emplace_back([this](std::stop_token st){
+                SearchPattern::Scratch s;
+                for (std::size_t i; !st.stop_requested() && (i = next_.fetch_add(1)) < units_.size(); ) {
+                    search_unit(*pat_, units_[i].off, units_[i].text, s, results_[i]);
+                    done_[i].store(true, std::memory_order_release);
+                    wake_ui();
+                }
+            });
+    }
+    // matches of the units finished since the last call, in document order
+    std::vector<Match> poll(){
+        std::vector<Match> out;
+        for (; published_ < units_.size() && done_[published_].load(std::memory_order_acquire); ++published_) {
+            out.insert(out.end(), results_[published_].begin(), results_[published_].end());
+            std::vector<Match>().swap(results_[published_]);
         }
-        counts[key]++;
+        if (published_ == units_.size() && !workers_.empty()) workers_.clear();   // all joined
+        return out;
     }
-    std::vector<std::pair<std::vector<std::string>, std::size_t>> vec(counts.begin(), counts.end());
-    std::sort(vec.begin(), vec.end(), [](auto& a, auto& b) { return a.second > b.second; });
-    if (vec.size() > topk) {
-        vec.resize(topk);
+    bool running() const { return published_ < units_.size(); }
+    std::size_t progress_percent() const { return units_.empty() ? 100 : published_ * 100 / units_.size(); }
+    void cancel(){
+        workers_.clear();             // jthread: request stop and join
+        units_.clear(); owned_.clear(); results_.clear(); published_ = 0;
     }
-    return vec;
-}
 
-// ============ token composition (alphabet = {1,2,3}) ============
+private:
+    std::shared_ptr<const SearchPattern> pat_;
+    std::vector<Unit> units_;
+    std::deque<std::string> owned_;
+    std::vector<std::vector<Match>> results_;
+    std::unique_ptr<std::atomic<bool>[]> done_;
+    std::atomic<std::size_t> next_{0};
+    std::size_t published_{0};
+    std::vector<std::jthread> workers_;   // last: joined before the state above goes away
+};
+
+// ============ display columns ============
+// A tab advances to the next multiple of TAB_STOP, a UTF-8 continuation
+// byte takes no cell, every other byte one. Lines longer than COL_STEP
+// bytes get an index holding the column at every COL_STEP-th byte, so any
+// byte <-> column lookup scans at most COL_STEP bytes.
 
-static constexpr std::array<char, 3> SAFE_ALPHABET{ '1','2','3' };
+static constexpr std::size_t TAB_STOP = 8;
+static constexpr std::size_t COL_STEP = 4096;
 
-static bool safe_pow_u64(std::uint64_t base,std::uint64_t exp,std::uint64_t& out){
-    out=1;
-    for(std::uint64_t i=0;i<exp;++i){
-        if(out> (std::numeric_limits<std::uint64_t>::max)()/base) return false;
-        out*=base;
-    }
-    return true;
+static inline std::size_t advance_column(std::size_t col, unsigned char c) {
+    if (c == '\t') return (col / TAB_STOP + 1) * TAB_STOP;
+    return (c & 0xC0) == 0x80 ? col : col + 1;
+}
+static inline std::size_t advance_columns(std::size_t col, std::string_view s) {
+    for (char c : s) col = advance_column(col, (unsigned char)c);
+    return col;
 }
 
-static std::string compose_permutations(std::uint64_t len, std::uint64_t limit){
-    if(!len || len>10 || !limit) return {};
-    std::uint64_t total;
-    if(!safe_pow_u64(SAFE_ALPHABET.size(),len,total)) total=limit;
-    total = std::min<std::uint64_t>(total, limit);
-    std::string out; out.reserve((len+1)*total);
-    std::string line(len,'1');
-    for(std::uint64_t i=0;i<total;++i){
-        std::uint64_t t=i;
-        for(int j=int(len)-1;j>=0;--j){
-            std::uint64_t idx = t % SAFE_ALPHABET.size();
-            line[(std::size_t)j] = SAFE_ALPHABET[(std::size_t)idx];
-            t /= SAFE_ALPHABET.size();
+// ============ C++ highlighting ============
+// A hand-written lexer colours the lines on screen. What carries over from
+// one line to the next (an open block comment, string or raw string, a
+// continued // comment or directive) is a 16-bit state, cached for every
+// line start up to the viewport. An edit distrusts the states after its
+// line; they are re-lexed only as far as the next frame needs, and only
+// until a line ends in the state the cache already holds for the one after.
+
+static bool is_cpp_file(std::string_view path){
+    static constexpr std::string_view EXT[] = {"c", "c++", "cc", "cpp", "cppm", "cxx", "h", "hh", "hpp", "hxx", "inl", "ipp", "ixx", "tpp"};
+    std::size_t dot = path.find_last_of('.');
+    if (dot == std::string_view::npos || path.find_first_of("/\\", dot) != std::string_view::npos) return false;
+    std::string ext(path.substr(dot + 1));
+    for (char& c : ext) c = (char)std::tolower((unsigned char)c);
+    return std::find(std::begin(EXT), std::end(EXT), ext) != std::end(EXT);
+}
+
+class CppLexer {
+public:
+    using State = std::uint16_t;
+    static constexpr State CODE = 0;
+
+    void reset(){ start_.assign(1, CODE); valid_ = 1; suspect_to_ = 0; delims_.clear(); }
+    // lines [y+1, y+1+removed) were replaced by `added` new ones, and line y changed
+    void edited(std::size_t y, std::size_t removed, std::size_t added){
+        // a re-lex that stopped short never checked the link into start_[valid_],
+        // so the states from there on stay suspect too
+        std::size_t suspect = valid_ < start_.size() ? std::max(suspect_to_, valid_) : suspect_to_;
+        if (y + 1 < start_.size()) {
+            auto at = start_.begin() + (std::ptrdiff_t)(y + 1);
+            start_.erase(at, at + (std::ptrdiff_t)std::min(removed, start_.size() - (y + 1)));
+            start_.insert(start_.begin() + (std::ptrdiff_t)(y + 1), added, CODE);
         }
-        out += line; out += '\n';
+        suspect_to_ = std::max(y + added + 1, suspect > y + removed ? suspect - removed + added : 0);
+        valid_ = std::min(valid_, y + 1);
     }
-    return out;
-}
+    // the state line y starts in; line(k) yields the text of line k < y
+    template <class F> State state_at(std::size_t y, F&& line){
+        while (valid_ <= y) {
+            State s = lex(line(valid_ - 1), start_[valid_ - 1], nullptr);
+            if (valid_ < start_.size()) {
+                // converged: the cached states past here hold again
+                if (valid_ >= suspect_to_ && start_[valid_] == s) { valid_ = start_.size(); continue; }
+                start_[valid_] = s;
+            } else start_.push_back(s);
+            ++valid_;
+        }
+        return start_[y];
+    }
+    // Lex one line from state `in` and return the state it ends in; attr,
+    // if given, receives a Screen::Attr for every byte of the line.
+    State lex(std::string_view s, State in, std::uint8_t* attr){
+        const std::size_t n = s.size();
+        auto mark = [&](std::size_t from, std::size_t to, std::uint8_t a){ if (attr) std::fill(attr + from, attr + std::min(to, n), a); };
+        bool pp = in & PP, continued = n && s[n - 1] == '\\';
+        State pp_bit = pp ? PP : 0;
+        std::size_t i = 0;
+        switch (in & KIND) {
+            case K_LINE_COMMENT: mark(0, n, Screen::COMMENT); return continued ? in : CODE;
+            case K_BLOCK: if (!close_block(s, i, mark)) return in; break;
+            case K_STRING: if (!close_quote(s, i, '"', mark)) return continued ? in : CODE; break;
+            case K_RAW: if (!close_raw(s, i, delims_[in >> RAW_SHIFT], mark)) return in; break;
+            default:
+                if (!pp) {
+                    std::size_t j = s.find_first_not_of(" \t");
+                    pp = j != std::string_view::npos && s[j] == '#'; pp_bit = pp ? PP : 0;
+                }
+        }
+        const std::uint8_t base = pp ? Screen::PREPROC : Screen::NORMAL;
+        bool include = false;   // after #include / #import, <...> is a file name
+        int words = in & PP ? 1 : 0;   // identifiers seen on a directive line (the first names it)
+        while (i < n) {
+            char c = s[i];
+            if (c == '/' && i + 1 < n && s[i + 1] == '/') { mark(i, n, Screen::COMMENT); return continued ? State(K_LINE_COMMENT | pp_bit) : CODE; }
+            if (c == '/' && i + 1 < n && s[i + 1] == '*') { i += 2; mark(i - 2, i, Screen::COMMENT); if (!close_block(s, i, mark)) return State(K_BLOCK | pp_bit); continue; }
+            if (c == '"' || c == '\'') {
+                mark(i, i + 1, Screen::STRING); ++i;
+                if (!close_quote(s, i, c, mark)) return c == '"' && continued ? State(K_STRING | pp_bit) : end_state(pp, continued);
+                continue;
+            }
+            if (c == '<' && include) {
+                std::size_t e = s.find('>', i);
+                e = e == std::string_view::npos ? n : e + 1;
+                mark(i, e, Screen::STRING); i = e; include = false; continue;
+            }
+            if (std::isdigit((unsigned char)c) || (c == '.' && i + 1 < n && std::isdigit((unsigned char)s[i + 1]))) {
+                std::size_t j = i + 1;   // a pp-number: digits, letters, '.', digit separators and exponent signs
+                while (j < n && (std::isalnum((unsigned char)s[j]) || s[j] == '.' || s[j] == '_'
+                                 || (s[j] == '\'' && j + 1 < n && std::isalnum((unsigned char)s[j + 1]))
+                                 || ((s[j] == '+' || s[j] == '-') && std::string_view("eEpP").find(s[j - 1]) != std::string_view::npos))) ++j;
+                mark(i, j, Screen::NUMBER); i = j; continue;
+            }
+            if (std::isalpha((unsigned char)c) || c == '_' || (unsigned char)c >= 0x80) {
+                std::size_t j = i + 1;
+                while (j < n && (std::isalnum((unsigned char)s[j]) || s[j] == '_' || (unsigned char)s[j] >= 0x80)) ++j;
+                std::string_view w = s.substr(i, j - i);
+                if (j < n && (s[j] == '"' || s[j] == '\'') && (w == "u8" || w == "u" || w == "U" || w == "L")) { mark(i, j, Screen::STRING); i = j; continue; }
+                if (j < n && s[j] == '"' && (w == "R" || w == "u8R" || w == "uR" || w == "UR" || w == "LR")) {
+                    std::size_t open = s.find('(', j + 1);
+                    std::string_view d = open == std::string_view::npos ? std::string_view() : s.substr(j + 1, open - j - 1);
+                    if (open != std::string_view::npos && d.size() <= 16 && d.find_first_of(" \t\\)\"") == std::string_view::npos) {
+                        mark(i, open + 1, Screen::STRING); i = open + 1;
+                        if (!close_raw(s, i, d, mark)) return State(K_RAW | pp_bit | (intern(d) << RAW_SHIFT));
+                        continue;
+                    }
+                }
+                std::uint8_t a = base;
+                if (pp && words++ == 0) include = w == "include" || w == "import" || w == "include_next";
+                else if (std::binary_search(std::begin(KEYWORDS), std::end(KEYWORDS), w)) a = Screen::KEYWORD;
+                else if (std::binary_search(std::begin(TYPES), std::end(TYPES), w)) a = Screen::TYPE;
+                mark(i, j, a); i = j; continue;
+            }
+            mark(i, i + 1, base); ++i;
+        }
+        return end_state(pp, continued);
+    }
+
+private:
+    enum Kind : State { K_CODE, K_BLOCK, K_STRING, K_LINE_COMMENT, K_RAW };
+    static constexpr State KIND = 7, PP = 8;   // PP: inside a (continued) directive
+    static constexpr int RAW_SHIFT = 4;        // raw strings keep their delimiter's id above the flags
+    static constexpr std::string_view KEYWORDS[] = {
+        "alignas", "alignof", "and", "and_eq", "asm", "break", "case", "catch", "class", "co_await", "co_return",
+        "co_yield", "compl", "concept", "const", "const_cast", "consteval", "constexpr", "constinit", "continue",
+        "decltype", "default", "delete", "do", "dynamic_cast", "else", "enum", "explicit", "export", "extern",
+        "false", "for", "friend", "goto", "if", "inline", "mutable", "namespace", "new", "noexcept", "not",
+        "not_eq", "nullptr", "operator", "or", "or_eq", "private", "protected", "public", "register",
+        "reinterpret_cast", "requires", "return", "sizeof", "static", "static_assert", "static_cast", "struct",
+        "switch", "template", "this", "thread_local", "throw", "true", "try", "typedef", "typeid", "typename",
+        "union", "using", "virtual", "volatile", "while", "xor", "xor_eq"};
+    static constexpr std::string_view TYPES[] = {
+        "auto", "bool", "char", "char16_t", "char32_t", "char8_t", "double", "float", "int", "int16_t", "int32_t",
+        "int64_t", "int8_t", "intptr_t", "long", "nullptr_t", "ptrdiff_t", "short", "signed", "size_t", "uint16_t",
+        "uint32_t", "uint64_t", "uint8_t", "uintptr_t", "unsigned", "void", "wchar_t"};
+    static_assert(std::is_sorted(std::begin(KEYWORDS), std::end(KEYWORDS)) && std::is_sorted(std::begin(TYPES), std::end(TYPES)));
+
+    std::vector<State> start_{CODE};   // start_[y]: state line y starts in
+    std::size_t valid_{1};             // start_[0, valid_) are known to be right
+    std::size_t suspect_to_{0};        // below this, a matching old state proves nothing
+    std::vector<std::string> delims_;  // raw-string delimiters by id
+
+    // a line that ends outside any construct ends a directive unless continued
+    static State end_state(bool pp, bool continued){ return pp && continued ? PP : CODE; }
+    // each scans from i to the end of its construct (or of the line) and reports whether it closed
+    template <class M> static bool close_block(std::string_view s, std::size_t& i, M& mark){
+        std::size_t e = s.find("*/", i);
+        bool closed = e != std::string_view::npos;
+        e = closed ? e + 2 : s.size();
+        mark(i, e, Screen::COMMENT); i = e; return closed;
+    }
+    template <class M> static bool close_quote(std::string_view s, std::size_t& i, char q, M& mark){
+        std::size_t j = i;
+        while (j < s.size() && s[j] != q) j += s[j] == '\\' ? 2 : 1;
+        bool closed = j < s.size();
+        j = closed ? j + 1 : s.size();
+        mark(i, j, Screen::STRING); i = j; return closed;
+    }
+    template <class M> static bool close_raw(std::string_view s, std::size_t& i, std::string_view d, M& mark){
+        std::size_t j = i;
+        for (; (j = s.find(')', j)) != std::string_view::npos; ++j)
+            if (s.substr(j + 1, d.size()) == d && j + 1 + d.size() < s.size() && s[j + 1 + d.size()] == '"') break;
+        std::size_t e = j == std::string_view::npos ? s.size() : j + d.size() + 2;
+        mark(i, e, Screen::STRING); i = e; return j != std::string_view::npos;
+    }
+    State intern(std::string_view d){
+        auto it = std::find(delims_.begin(), delims_.end(), d);
+        if (it != delims_.end()) return State(it - delims_.begin());
+        if (delims_.size() >= (std::size_t(1) << (16 - RAW_SHIFT))) return 0;   // out of ids: share the first
+        delims_.emplace_back(d);
+        return State(delims_.size() - 1);
+    }
+};
 
 // ============ Editor ============
 
 class Editor {
 public:
-    explicit Editor(const char* initial): filename_(initial?initial:"untitled.txt") {
+    // journal=false keeps no swap files (the benchmarks time edits without disk I/O)
+    explicit Editor(const char* initial, bool journal = true): filename_(initial?initial:"untitled.txt"), journal_(journal) {
         if (initial && std::ifstream(initial).good()) { open_file(filename_); dirty_=false; }
-        else buffer_.push_back("");
+        else { attach_swap(); reset_highlight(); }
     }
     int run(){
         enable_vt();
-        status_ = "Press ESC for COMMAND mode (:help)";
+        status_ = swap_ && swap_->held() ? "Swap file found: :recover replays it, :recover discard deletes it."
+                                         : "Press ESC for COMMAND mode (:help)";
         for(;;){
             ensure_visible();
             draw();
@@ -231,8 +2994,11 @@ public:
         }
     }
 private:
-    // buffer state
-    std::vector<std::string> buffer_;
+#ifdef VIMIFIED_BENCH
+    friend struct EditorBench;  // drives the private edit and file primitives
+#endif
+    // buffer state (of the buffer on screen; the others are parked in bufs_)
+    std::unique_ptr<PieceTable> buffer_{std::make_unique<PieceTable>()};
     std::string filename_;
     std::string status_{"ready"};
     std::string mode_{"EDIT"};
@@ -240,100 +3006,551 @@ private:
     bool dirty_{false};
     int cur_y_{0}, cur_x_{0};
     int off_y_{0}, off_x_{0};
+    Screen screen_;
+    ConsoleInput input_;
+    int term_rows_{0}, term_cols_{0};   // cached console size, see console_size()
+    // off_x_ is a display column; cur_x_ stays a byte offset into the line.
+    // Column indexes of long lines, by line number; splice() drops the lines it shifts.
+    struct ColumnIndex { std::size_t len; std::vector<std::size_t> at; };   // at[k]: column of byte k*COL_STEP
+    std::map<std::size_t, ColumnIndex> col_index_;
+    std::string row_;   // scratch for one rendered row
+    std::string bar_left_, bar_right_;   // status bar halves, reused every frame
+    // scratch the edit path reuses, so typing allocates nothing once they have grown
+    std::string run_, block_, gone_, recount_;
+    // C++ colouring of the rows on screen (:syntax toggles it for C++ files)
+    CppLexer hl_;
+    bool syntax_{true}, hl_on_{false};
+    std::string hl_text_;
+    std::vector<std::uint8_t> hl_attr_;
+    static constexpr std::size_t HL_LINE_MAX = std::size_t(64) << 10;   // longer lines are shown plain
+    static void release_large(std::string& s){ if (s.capacity() > (std::size_t(1) << 20)) std::string().swap(s); }
+    // :! jobs stream into their own buffer, shown in a pane above the status bar
+    std::unique_ptr<ShellJob> job_;
+    std::string job_cmd_;
+    PieceTable shell_out_;
+    bool out_visible_{false};
+    bool job_pending_{false};   // job_ was running at the last idle_tick
+    bool cpp_pch_{false};
+    ReplSession repl_;
+    std::string repl_exe_{"clang-repl"};
+    enum class Pane { SHELL, REPL, QUICKFIX, REPORT };
+    Pane pane_{Pane::SHELL};    // what the output pane currently shows
+    std::string report_title_;
+    std::vector<std::string> report_;   // Pane::REPORT lines (e.g. :perf)
+#ifdef VIMIFIED_PERF
+    std::int64_t key_at_{0};    // when the key being handled was read
+#endif
+    std::unique_ptr<ShellJob> cpp_job_;   // running compiler, if any
+    std::string cpp_src_, cpp_building_, cpp_linked_;  // temp source, binary being built, temp name g++ links to
+    QuickfixList qf_;
+    UndoLog undo_;
+    std::unique_ptr<SwapFile> swap_;   // crash journal of this buffer; null while journaling is off
+    bool journal_{true};
+    LiveTokenStats live_;       // built on the first :tok query (or by the HUD), then kept current by splice()
+    bool hud_{false};           // status bar shows live token analytics
+    // background work between keystrokes runs in slices of at most this long
+    static constexpr auto IDLE_BUDGET = std::chrono::milliseconds(8);
+    // longest sleep between polls while background work runs; its threads
+    // set wake_event() as results arrive, this only bounds a missed wake
+    static constexpr DWORD BUSY_WAIT_MS = 100;
+    // idle_tick() keeps this much room in the piece table and undo journal,
+    // so a keystroke does not allocate
+    static constexpr std::size_t EDIT_HEADROOM = 4096;
+    // :cpp binaries of this session, least recently used first; past
+    // CPP_BUILDS_KEPT the oldest is deleted
+    std::deque<std::string> cpp_builds_;
+    static constexpr std::size_t CPP_BUILDS_KEPT = 8;
+    // /pattern: matches stream in from the background search in document order
+    std::shared_ptr<const SearchPattern> search_pat_;
+    std::string search_src_;
+    SearchJob search_job_;
+    std::vector<SearchPattern::Match> matches_;
+    bool search_jump_{false};   // move to the first match after the cursor once it arrives
+    bool index_on_{false};      // :index keeps per-unit trigram sets for literal searches
+    TrigramIndex trigrams_;
+    static constexpr std::size_t SEARCH_UNIT = std::size_t(256) << 10;
+    // :e / :bn / :bp. The active buffer lives in the members above and its
+    // slot in bufs_ is empty; switching parks it and moves the target in.
+    // An unmodified, mapped buffer that is not on screen can be evicted
+    // under the memory budget: it keeps only its name and cursor and is
+    // mapped (and indexed in the background) again when switched to.
+    struct ParkedBuffer {
+        std::unique_ptr<PieceTable> text;   // null when evicted or not loaded yet
+        std::string filename;
+        bool dirty{false};
+        int cur_y{0}, cur_x{0}, off_y{0}, off_x{0};
+        UndoLog undo;
+        std::unique_ptr<SwapFile> swap;
+        std::uint64_t used{0};              // last time it was on screen (switch count)
+    };
+    std::vector<ParkedBuffer> bufs_{1};
+    std::size_t cur_buf_{0};
+    std::uint64_t buf_tick_{0};
+    std::size_t mem_budget_{std::size_t(1) << 30};
+
+    int line_count() const { return (int)buffer_->line_count(); }
+    int line_len(int y) const { return (int)buffer_->line_length((std::size_t)y); }
+    std::size_t cursor_offset() const { return buffer_->offset_of((std::size_t)cur_y_, (std::size_t)cur_x_); }
 
     // ---- rendering ----
+    // output pane height (0 when hidden); never more than a third of the screen
+    int pane_rows(int rows) const { return out_visible_ ? std::clamp(rows / 3, 0, 12) : 0; }
+    // The size is asked of the console only at startup and after a resize
+    // event; a resize also repaints everything, since the console may have
+    // reflowed or scrolled what it showed.
+    void console_size(int& rows, int& cols){
+        if (!input_.console()) { get_console_size(rows, cols); return; }
+        if (input_.take_resize() || !term_rows_) {
+            get_console_size(term_rows_, term_cols_);
+            screen_.invalidate();
+        }
+        rows = term_rows_; cols = term_cols_;
+    }
     void ensure_visible(){
-        int rows, cols; get_console_size(rows, cols);
-        int view_h = std::max(1, rows-1), view_w = std::max(1, cols);
+        PERF_SCOPE("ensure_visible");
+        int rows, cols; console_size(rows, cols);
+        int view_h = std::max(1, rows-1-pane_rows(rows)), view_w = std::max(1, cols);
+        // a mapped file is indexed in the background; only wait for the lines
+        // the viewport (plus one below the cursor) actually needs
+        buffer_->poll_index();
+        buffer_->ensure_lines((std::size_t)std::max(off_y_ + view_h, cur_y_ + 1) + 1);
         if (cur_y_ < off_y_) off_y_ = cur_y_;
         if (cur_y_ >= off_y_ + view_h) off_y_ = cur_y_ - view_h + 1;
-        if (cur_x_ < off_x_) off_x_ = cur_x_;
-        if (cur_x_ >= off_x_ + view_w) off_x_ = cur_x_ - view_w + 1;
+        int cx = (int)column_of((std::size_t)cur_y_, (std::size_t)cur_x_);
+        if (cx < off_x_) off_x_ = cx;
+        if (cx >= off_x_ + view_w) off_x_ = cx - view_w + 1;
         if (off_y_ < 0) off_y_ = 0;
         if (off_x_ < 0) off_x_ = 0;
     }
     void draw(){
-        int rows, cols; get_console_size(rows, cols);
-        clear_screen();
-        for(int y=0; y<rows-1; ++y){
+        PERF_SCOPE("draw");
+        compose();
+        screen_.present();
+#ifdef VIMIFIED_PERF
+        if (key_at_) { PerfLog::get().record("key_to_paint", key_at_, PerfLog::now()); key_at_ = 0; }
+#endif
+    }
+    // the frame into screen_'s back buffer
+    void compose(){
+        int rows, cols; console_size(rows, cols);
+        screen_.resize(rows, cols); screen_.clear();
+        int pane = pane_rows(rows), text_h = rows-1-pane;
+        for(int y=0; y<text_h; ++y){
             int by = off_y_ + y;
-            if (by < 0 || by >= (int)buffer_.size()) break;
-            const std::string& full = buffer_[(std::size_t)by];
-            std::string slice;
-            if (off_x_ < (int)full.size()) slice = full.substr((std::size_t)off_x_);
-            move_cursor(y,0); std::cout << slice;
-        }
-        // status bar
-        std::string dirty = dirty_ ? " [+]" : "";
-        std::ostringstream left, right;
-        left  << " " << mode_ << " | " << filename_ << dirty
-              << " | L" << (cur_y_+1) << ", C" << (cur_x_+1) << " ";
-        right << " " << status_ << " ";
-        std::string L = left.str(), R = right.str();
+            if (by < 0 || by >= line_count()) break;
+            auto [b, e] = render_row((std::size_t)by, cols);
+            screen_.put(y, 0, row_);
+            if (hl_on_) paint_syntax(y, (std::size_t)by, b, e, cols);
+            if (!matches_.empty()) paint_matches(y, (std::size_t)by, b, e);
+        }
+        if (pane > 0) draw_output_pane(text_h, pane, cols);
+        // status bar, composed in reused strings so a frame does not allocate
+        std::string& L = bar_left_;
+        char num[96];
+        L.assign(" ").append(mode_).append(" | ");
+        if (bufs_.size() > 1) { std::snprintf(num, sizeof(num), "[%zu/%zu] ", cur_buf_ + 1, bufs_.size()); L += num; }
+        L.append(filename_).append(dirty_ ? " [+]" : "");
+        std::snprintf(num, sizeof(num), " | L%d, C%d ", cur_y_+1, cur_x_+1); L += num;
+        if (hud_) {
+            if (live_.valid()) {
+                const TokenStats& st = live_.stats();
+                std::snprintf(num, sizeof(num), "| %zu tok, %zu uniq, H %.2f ", st.tokens, st.unique_tokens, st.token_entropy);
+            } else std::snprintf(num, sizeof(num), "| stats %zu%% ", live_.covered() * 100 / std::max<std::size_t>(1, buffer_->total_size()));
+            L += num;
+        }
+        std::string& R = bar_right_;
+        R.assign(" ").append(status_).append(" ");
         int fill = cols - (int)L.size() - (int)R.size(); if (fill<0) fill=0;
-        move_cursor(rows-1, 0); invert_on();
-        std::cout << L << std::string(fill,' ') << R;
-        invert_off();
+        screen_.put(rows-1, 0, L, Screen::INVERSE);
+        screen_.fill(rows-1, (int)L.size(), fill, Screen::INVERSE);
+        screen_.put(rows-1, (int)L.size() + fill, R, Screen::INVERSE);
         // cursor
-        int dy = cur_y_ - off_y_, dx = cur_x_ - off_x_;
-        if (dy >= 0 && dy < rows-1 && dx >= 0 && dx < cols) move_cursor(dy, dx);
-        std::cout.flush();
+        int dy = cur_y_ - off_y_, dx = (int)column_of((std::size_t)cur_y_, (std::size_t)cur_x_) - off_x_;
+        if (dy >= 0 && dy < text_h && dx >= 0 && dx < cols) screen_.set_cursor(dy, dx);
+    }
+    // Columns [off_x_, off_x_ + cols) of line y into row_, tabs expanded.
+    // Only that window is read, however long the line. Returns the byte
+    // range [b, e) of the line it shows.
+    std::pair<std::size_t, std::size_t> render_row(std::size_t y, int cols){
+        row_.clear();
+        std::size_t ls = buffer_->line_start(y), len = buffer_->line_length(y), left = (std::size_t)off_x_;
+        std::size_t col, b = byte_at_column(y, left, col), e = b;
+        std::size_t right = left + (std::size_t)cols;
+        // a cell holds up to 4 bytes, so this many bytes always fill the row
+        buffer_->for_range(ls + b, std::min(len - b, (std::size_t)cols * 4), [&](std::string_view v){
+            for (char c : v) {
+                std::size_t next = advance_column(col, (unsigned char)c);
+                if (col >= right && next > col) return;
+                if (c == '\t') row_.append(std::min(next, right) - std::max(col, left), ' ');
+                else row_.push_back(c);
+                col = next; e++;
+            }
+        });
+        return {b, e};
+    }
+    // A stale index (edited line, or the last line growing while a mapped
+    // file is indexed) keeps its valid prefix and is extended from there.
+    const std::vector<std::size_t>& column_index(std::size_t y, std::size_t ls, std::size_t len){
+        auto [it, fresh] = col_index_.try_emplace(y);
+        if (fresh || it->second.len != len) {
+            it->second.len = len;
+            auto& idx = it->second.at;
+            std::size_t col = 0, at = 0;
+            if (!idx.empty()) { at = (idx.size() - 1) * COL_STEP; col = idx.back(); idx.pop_back(); }
+            idx.reserve(len / COL_STEP + 1);
+            buffer_->for_range(ls + at, len - at, [&](std::string_view v){
+                for (char c : v) { if (at++ % COL_STEP == 0) idx.push_back(col); col = advance_column(col, (unsigned char)c); }
+            });
+        }
+        return it->second.at;
+    }
+    // lines y..y_end were rewritten from byte `in` of line y on: y keeps the
+    // checkpoints before that, the rest lose their index, and all later lines
+    // are dropped too if the edit moved them
+    void fix_column_index(std::size_t y, std::size_t y_end, std::size_t in, bool lines_moved){
+        auto it = col_index_.lower_bound(y);
+        if (it != col_index_.end() && it->first == y) {
+            it->second.at.resize(std::min(it->second.at.size(), in / COL_STEP + 1));
+            it->second.len = std::string_view::npos;
+            ++it;
+        }
+        col_index_.erase(it, lines_moved ? col_index_.end() : col_index_.upper_bound(y_end));
+    }
+    // display column where byte x of line y starts
+    std::size_t column_of(std::size_t y, std::size_t x){
+        std::size_t ls = buffer_->line_start(y), len = buffer_->line_length(y);
+        x = std::min(x, len);
+        std::size_t from = 0, col = 0;
+        if (len > COL_STEP) {
+            const auto& idx = column_index(y, ls, len);
+            std::size_t k = std::min(x / COL_STEP, idx.size() - 1);
+            from = k * COL_STEP; col = idx[k];
+        }
+        buffer_->for_range(ls + from, x - from, [&](std::string_view v){ col = advance_columns(col, v); });
+        return col;
+    }
+    // first byte of line y whose cell reaches past column `want`; `col` is where it starts
+    std::size_t byte_at_column(std::size_t y, std::size_t want, std::size_t& col){
+        std::size_t ls = buffer_->line_start(y), len = buffer_->line_length(y), b = 0;
+        col = 0;
+        if (len > COL_STEP) {
+            const auto& idx = column_index(y, ls, len);
+            std::size_t k = std::size_t(std::upper_bound(idx.begin(), idx.end(), want) - idx.begin()) - 1;
+            b = k * COL_STEP; col = idx[k];
+        }
+        bool found = false;
+        buffer_->for_range(ls + b, len - b, [&](std::string_view v){
+            for (std::size_t i = 0; i < v.size() && !found; ++i) {
+                std::size_t next = advance_column(col, (unsigned char)v[i]);
+                if (next > want) { found = true; break; }
+                col = next; b++;
+            }
+        });
+        return b;
+    }
+    // colour screen row y, which shows bytes [b, e) of line by; the line is
+    // lexed from its start to a little past e, so a cut-off word still reads whole
+    void paint_syntax(int y, std::size_t by, std::size_t b, std::size_t e, int cols){
+        std::size_t len = buffer_->line_length(by);
+        if (len > HL_LINE_MAX) return;
+        CppLexer::State in = hl_.state_at(by, [&](std::size_t k){
+            buffer_->copy(buffer_->line_start(k), buffer_->line_length(k), hl_text_);
+            return std::string_view(hl_text_);
+        });
+        buffer_->copy(buffer_->line_start(by), std::min(len, e + 256), hl_text_);
+        hl_attr_.resize(hl_text_.size());
+        hl_.lex(hl_text_, in, hl_attr_.data());
+        std::size_t col, left = (std::size_t)off_x_, right = left + (std::size_t)cols;
+        byte_at_column(by, left, col);
+        for (std::size_t i = b; i < e; ++i) {
+            std::size_t next = advance_column(col, (unsigned char)hl_text_[i]);
+            if (next > col && hl_attr_[i] != Screen::NORMAL) {
+                std::size_t c0 = std::max(col, left);
+                screen_.paint(y, (int)(c0 - left), (int)(std::min(next, right) - c0), hl_attr_[i]);
+            }
+            col = next;
+        }
+    }
+    // inverse-video the matches on screen row y, which shows bytes [b, e) of line by
+    void paint_matches(int y, std::size_t by, std::size_t b, std::size_t e){
+        std::size_t ls = buffer_->line_start(by);
+        auto it = std::lower_bound(matches_.begin(), matches_.end(), ls + b, [](const SearchPattern::Match& m, std::size_t p){ return m.first + m.second <= p; });
+        for (; it != matches_.end() && it->first < ls + e; ++it) {
+            int c0 = (int)column_of(by, it->first - ls) - off_x_;
+            int c1 = (int)column_of(by, it->first + it->second - ls) - off_x_;
+            screen_.paint(y, c0, c1 - c0, Screen::INVERSE);
+        }
+    }
+    // title row, then the tail of the shell output
+    void draw_output_pane(int top, int height, int cols){
+        if (pane_ == Pane::QUICKFIX) { draw_quickfix_pane(top, height, cols); return; }
+        std::string title;
+        if (pane_ == Pane::REPORT) {
+            title = " " + report_title_ + " ";
+            screen_.put(top, 0, title, Screen::INVERSE);
+            screen_.fill(top, (int)title.size(), cols - (int)title.size(), Screen::INVERSE);
+            for (int r = 1; r < height && (std::size_t)(r-1) < report_.size(); ++r) screen_.put(top + r, 0, report_[(std::size_t)(r-1)]);
+            return;
+        }
+        if (pane_ == Pane::REPL)
+            title = " repl: " + repl_exe_ + "  [" + (repl_.busy() ? "evaluating" : repl_.alive() ? "ready" : "stopped") + "] ";
+        else {
+            std::string state = job_ && job_->running() ? "running, :kill to cancel"
+                              : job_ ? (job_->cancelled() ? "cancelled" : "exit " + std::to_string(job_->exit_code())) : "idle";
+            title = " :! " + job_cmd_ + "  [" + state + "] ";
+        }
+        screen_.put(top, 0, title, Screen::INVERSE);
+        screen_.fill(top, (int)title.size(), cols - (int)title.size(), Screen::INVERSE);
+        std::size_t n = shell_out_.line_count();
+        // a trailing newline leaves an empty last line; don't spend a row on it
+        if (n > 1 && shell_out_.line_length(n-1) == 0) n--;
+        std::size_t first = n > (std::size_t)(height-1) ? n - (std::size_t)(height-1) : 0;
+        for (int r = 1; r < height && first + (std::size_t)(r-1) < n; ++r)
+            screen_.put(top + r, 0, shell_out_.line(first + (std::size_t)(r-1)));
+    }
+
+    void draw_quickfix_pane(int top, int height, int cols){
+        std::string title = " quickfix: " + std::to_string(qf_.errors()) + " errors, " + std::to_string(qf_.warnings())
+                          + " warnings  [" + (cpp_job_ ? "compiling, :kill cancels" : ":cn / :cp") + "] ";
+        screen_.put(top, 0, title, Screen::INVERSE);
+        screen_.fill(top, (int)title.size(), cols - (int)title.size(), Screen::INVERSE);
+        const auto& es = qf_.entries();
+        std::size_t rows = (std::size_t)(height - 1), cur = qf_.current_index();
+        // follow the selection, or the newest entries while the build streams in
+        std::size_t first = (cur != (std::numeric_limits<std::size_t>::max)())
+                          ? (cur >= rows / 2 ? cur - rows / 2 : 0)
+                          : (es.size() > rows ? es.size() - rows : 0);
+        for (std::size_t r = 0; r < rows && first + r < es.size(); ++r) {
+            const auto& e = es[first + r];
+            std::string row = (first + r == cur ? "> " : "  ") + std::string(qf_.file(e)) + ":" + std::to_string(e.line)
+                            + (e.col ? ":" + std::to_string(e.col) : "") + ": " + QuickfixList::severity_name(e.sev) + ": "
+                            + std::string(qf_.message(e));
+            screen_.put(top + 1 + (int)r, 0, row);
+        }
+    }
+
+    // ---- input ----
+    // Block for the next key. While a shell job or the line indexer is busy,
+    // adopt their progress and repaint between short polls instead.
+    int read_key(){
+        while (!input_.ready()) {
+            bool busy = (job_ && (job_->running() || job_pending_)) || repl_.busy() || cpp_job_ || buffer_->indexing()
+                     || stats_pending() || search_job_.running();
+            if (!busy) {
+                // nothing to poll: sleep in the console wait, waking for keys and resizes
+                if (!input_.wait()) break;
+                if (input_.resized()) { ensure_visible(); draw(); }
+                continue;
+            }
+            bool changed = idle_tick();
+            bool worked = stats_pending() && build_stats(std::chrono::steady_clock::now() + IDLE_BUDGET);
+            if (changed || worked || input_.resized()) { ensure_visible(); draw(); }
+            if (!worked) input_.wait_or_wake(BUSY_WAIT_MS);
+        }
+        idle_tick();
+        int ch = input_.get();
+#ifdef VIMIFIED_PERF
+        key_at_ = PerfLog::now();
+#endif
+        return ch;
+    }
+    bool stats_pending() const { return hud_ && !live_.valid(); }
+    // Count the next uncounted lines for the live stats until `deadline`.
+    // Returns false when nothing could be done (e.g. waiting on the indexer).
+    bool build_stats(std::chrono::steady_clock::time_point deadline){
+        constexpr std::size_t SLICE = std::size_t(256) << 10;
+        bool worked = false;
+        if (!live_.active()) live_.start();
+        while (!live_.valid()) {
+            std::size_t cov = live_.covered(), size = buffer_->size();
+            std::size_t want = std::min(size, cov + SLICE);
+            std::size_t end = want >= size ? size : buffer_->line_start(buffer_->line_of(want) + 1);
+            bool last = end >= size && !buffer_->indexing();
+            // while the indexer runs, the last indexed line may still grow
+            if (end >= size && !last) end = std::max(cov, buffer_->line_start(buffer_->line_count() - 1));
+            if (end == cov && !last) break;
+            live_.extend(buffer_->substr(cov, end - cov), last);
+            worked = true;
+            if (std::chrono::steady_clock::now() >= deadline) break;
+        }
+        return worked;
+    }
+    bool idle_tick(){
+        buffer_->reserve_edits(EDIT_HEADROOM, EDIT_HEADROOM / 64);
+        undo_.reserve_edits(EDIT_HEADROOM, EDIT_HEADROOM / 64);
+        bool changed = buffer_->poll_index();
+        if (search_job_.running()) changed = poll_search() || changed;
+        if (job_) {
+            bool was_running = job_pending_;
+            std::string chunk = job_->poll();
+            if (!chunk.empty()) { shell_out_.insert(shell_out_.size(), chunk); changed = true; }
+            job_pending_ = job_->running();
+            if (was_running && !job_pending_) {
+                chunk = job_->poll();   // output that raced the exit
+                if (!chunk.empty()) shell_out_.insert(shell_out_.size(), chunk);
+                if (job_->cancelled()) status_ = "Command cancelled.";
+                else if (trim_copy(shell_out_.text()).empty()) status_ = "Command produced no output.";
+                else status_ = "Command finished (:out put inserts the output).";
+                changed = true;
+            }
+        }
+        if (cpp_job_) {
+            std::string chunk = cpp_job_->poll();
+            if (!chunk.empty()) { qf_.feed(chunk); changed = true; }
+            if (!cpp_job_->running()) { finish_cpp_build(); changed = true; }
+        }
+        if (pane_ == Pane::REPL) {
+            bool was_busy = repl_.busy();
+            std::string chunk = repl_.poll();
+            if (!chunk.empty()) { shell_out_.insert(shell_out_.size(), chunk); changed = true; }
+            if (was_busy && !repl_.busy()) { status_ = repl_.alive() ? "Evaluated." : "REPL exited."; changed = true; }
+        }
+        return changed;
     }
 
     // ---- editing ----
+    // every document change goes through edit_insert / edit_erase so the journal sees it
+    void edit_insert(std::size_t pos, std::string_view s, bool typing = false){
+        undo_.record(pos, {}, s, typing);
+        splice(pos, 0, s);
+    }
+    void edit_erase(std::size_t pos, std::size_t n){
+        buffer_->copy(pos, n, gone_);
+        undo_.record(pos, gone_, {}); release_large(gone_);
+        splice(pos, n, {});
+    }
+    void edit_replace(std::size_t pos, std::size_t n, std::string_view s){
+        buffer_->copy(pos, n, gone_);
+        undo_.record(pos, gone_, s); release_large(gone_);
+        splice(pos, n, s);
+    }
+    // replace n bytes at pos with s; live token stats re-count only the lines involved
+    // (while the stats are still being built, only lines inside the counted prefix are)
+    void splice(std::size_t pos, std::size_t n, std::string_view s){
+        auto line_end = [&](std::size_t y){ return y + 1 < buffer_->line_count() ? buffer_->line_start(y + 1) : buffer_->size(); };
+        std::size_t from = 0, to = 0, cov = live_.covered();
+        bool counted = false;
+        if (live_.active()) {
+            from = buffer_->line_start(buffer_->line_of(pos));
+            to = line_end(buffer_->line_of(pos + n));
+            counted = from < cov || live_.valid();
+            if (counted) { buffer_->copy(from, std::min(to, cov) - from, recount_); live_.remove(recount_); }
+        }
+        cancel_search();   // match offsets and unit views are stale now
+        trigrams_.edited(pos, n, s.size());
+        std::size_t ey = 0, ein = 0, lines = 0, ey_end = 0;
+        if (!col_index_.empty() || hl_on_) {
+            ey = buffer_->line_of(pos); ein = pos - buffer_->line_start(ey); lines = buffer_->line_count();
+            ey_end = buffer_->line_of(pos + n);
+        }
+        if (swap_ && !swap_->append(pos, n, s)) {
+            status_ = "swap: cannot write " + swap_->path() + " (edits are not crash-safe; :w still saves).";
+            swap_->discard(); swap_.reset();
+        }
+        buffer_->erase(pos, n); buffer_->insert(pos, s);
+        if (!col_index_.empty()) fix_column_index(ey, ey_end, ein, lines != buffer_->line_count());
+        if (hl_on_) hl_.edited(ey, ey_end - ey, (std::size_t)std::count(s.begin(), s.end(), '\n'));
+        if (counted) {
+            if (to <= cov || live_.valid()) {
+                buffer_->copy(from, line_end(buffer_->line_of(pos + s.size())) - from, recount_);
+                live_.add(recount_); release_large(recount_);
+                live_.set_covered(cov + s.size() - n);
+            } else live_.set_covered(from);   // the straddled lines get recounted by build_stats
+        }
+        dirty_ = true;
+    }
+    void move_to_offset(std::size_t pos){
+        cur_y_ = (int)buffer_->line_of(pos);
+        cur_x_ = (int)(pos - buffer_->line_start((std::size_t)cur_y_));
+    }
+    void undo(){
+        auto c = undo_.undo();
+        if (!c) { status_ = "Already at oldest change."; return; }
+        splice(c->pos, c->inserted.size(), c->removed);
+        move_to_offset(c->pos);
+        status_ = "Undo (" + std::to_string(undo_.steps()) + " steps left).";
+    }
+    void redo(){
+        auto c = undo_.redo();
+        if (!c) { status_ = "Already at newest change."; return; }
+        splice(c->pos, c->removed.size(), c->inserted);
+        move_to_offset(c->pos + c->inserted.size());
+        status_ = "Redo.";
+    }
     void insert_char(char c){
-        if (buffer_.empty()) buffer_.push_back("");
-        std::string& line = buffer_[(std::size_t)cur_y_];
-        cur_x_ = std::clamp(cur_x_, 0, (int)line.size());
-        line.insert((std::size_t)cur_x_, 1, c);
-        cur_x_++; dirty_ = true;
+        cur_x_ = std::clamp(cur_x_, 0, line_len(cur_y_));
+        edit_insert(cursor_offset(), std::string_view(&c, 1), true);
+        cur_x_++;
     }
     void newline(){
-        std::string& line = buffer_[(std::size_t)cur_y_];
-        std::string tail = line.substr((std::size_t)cur_x_);
-        line.resize((std::size_t)cur_x_);
-        buffer_.insert(buffer_.begin()+cur_y_+1, tail);
-        cur_y_++; cur_x_=0; dirty_=true;
+        edit_insert(cursor_offset(), buffer_->eol());
+        cur_y_++; cur_x_=0;
     }
     void backspace(){
         if (cur_x_>0){
-            std::string& line = buffer_[(std::size_t)cur_y_];
-            line.erase((std::size_t)(cur_x_-1),1); cur_x_--; dirty_=true;
+            edit_erase(cursor_offset()-1, 1); cur_x_--;
         } else if (cur_y_>0){
-            int prev_len = (int)buffer_[(std::size_t)cur_y_-1].size();
-            buffer_[(std::size_t)cur_y_-1] += buffer_[(std::size_t)cur_y_];
-            buffer_.erase(buffer_.begin()+cur_y_);
-            cur_y_--; cur_x_=prev_len; dirty_=true;
+            int prev_len = line_len(cur_y_-1);
+            std::size_t eol = buffer_->eol_length((std::size_t)cur_y_-1);
+            edit_erase(buffer_->line_start((std::size_t)cur_y_) - eol, eol);
+            cur_y_--; cur_x_=prev_len;
         }
     }
     void del_key(){
-        std::string& line = buffer_[(std::size_t)cur_y_];
-        if (cur_x_ < (int)line.size()) { line.erase((std::size_t)cur_x_,1); dirty_=true; }
-        else if (cur_y_ < (int)buffer_.size()-1) {
-            line += buffer_[(std::size_t)cur_y_+1];
-            buffer_.erase(buffer_.begin()+cur_y_+1); dirty_=true;
-        }
+        if (cur_x_ < line_len(cur_y_)) edit_erase(cursor_offset(), 1);
+        else if (cur_y_ < line_count()-1) edit_erase(cursor_offset(), buffer_->eol_length((std::size_t)cur_y_));
     }
+    // One input batch: every key already queued is applied before the next
+    // frame, and a run of typed text (a paste) goes in as a single splice.
     void edit_loop(){
-        int ch = _getch();
+        for (int ch = read_key(); ch >= 0; ) {
+            if (text_key(ch)) {
+                run_.clear();
+                for (; ch >= 0 && text_key(ch); ch = pending_key()) run_.push_back(ch == '\r' ? '\n' : (char)ch);
+                type_text(run_); release_large(run_);
+                continue;
+            }
+            edit_key(ch);
+            if (mode_ != "EDIT") return;   // after ESC the rest of the batch is command input
+            ch = pending_key();
+        }
+    }
+    // the next key of the current batch, or -1 once the queue is empty (never blocks)
+    int pending_key(){ return input_.ready() ? input_.get() : -1; }
+    // keys that insert text (h/j/k/l move the cursor)
+    static bool text_key(int ch){ return ch == '\r' || ch == '\n' || (ch >= 32 && ch <= 126 && !std::strchr("hjkl", ch)); }
+    void type_text(std::string_view run){
+        if (run == "\n") newline();
+        else if (run.size() == 1) insert_char(run[0]);
+        else {
+            // a run without line breaks joins the undo step of the typing around it
+            cur_x_ = std::clamp(cur_x_, 0, line_len(cur_y_));
+            insert_text_block(run, run.find('\n') == std::string_view::npos);
+        }
+        cur_y_ = std::clamp<int>(cur_y_, 0, line_count()-1);
+        cur_x_ = std::clamp<int>(cur_x_, 0, line_len(cur_y_));
+    }
+    void edit_key(int ch){
         switch (ch){
-            case 27: mode_="COMMAND"; status_.clear(); cmdbuf_.clear(); break; // ESC
+            case 27: mode_="COMMAND"; status_=":"; cmdbuf_.clear(); undo_.seal(); break; // ESC
+            case 26: undo(); break; // Ctrl+Z
+            case 25: redo(); break; // Ctrl+Y
             case '\r': case '\n': newline(); break;
             case 8: backspace(); break; // Backspace
             case 224: { // extended keys: arrows, Delete, etc.
-                int c2 = _getch();
+                int c2 = input_.get();
                 if (c2 == 72) { // Up
                     if (cur_y_>0) cur_y_--;
-                    cur_x_ = std::min<int>(cur_x_, (int)buffer_[(std::size_t)cur_y_].size());
+                    cur_x_ = std::min<int>(cur_x_, line_len(cur_y_));
                 } else if (c2 == 80) { // Down
-                    if (cur_y_<(int)buffer_.size()-1) cur_y_++;
-                    cur_x_ = std::min<int>(cur_x_, (int)buffer_[(std::size_t)cur_y_].size());
+                    if (cur_y_<line_count()-1) cur_y_++;
+                    cur_x_ = std::min<int>(cur_x_, line_len(cur_y_));
                 } else if (c2 == 75) { // Left
                     if (cur_x_>0) cur_x_--;
-                    else if (cur_y_>0){ cur_y_--; cur_x_ = (int)buffer_[(std::size_t)cur_y_].size(); }
+                    else if (cur_y_>0){ cur_y_--; cur_x_ = line_len(cur_y_); }
                 } else if (c2 == 77) { // Right
-                    if (cur_x_ < (int)buffer_[(std::size_t)cur_y_].size()) cur_x_++;
-                    else if (cur_y_<(int)buffer_.size()-1){ cur_y_++; cur_x_=0; }
+                    if (cur_x_ < line_len(cur_y_)) cur_x_++;
+                    else if (cur_y_<line_count()-1){ cur_y_++; cur_x_=0; }
                 } else if (c2 == 83) { // Delete
                     del_key();
                 }
@@ -341,109 +3558,476 @@ private:
             }
             case 127: del_key(); break; // Some keyboards send 127 for Delete
             default:
-                if (ch== 'h') { if (cur_x_>0) cur_x_--; else if (cur_y_>0){ cur_y_--; cur_x_ = (int)buffer_[(std::size_t)cur_y_].size(); } }
-                else if (ch=='j'){ if (cur_y_<(int)buffer_.size()-1) cur_y_++; cur_x_ = std::min<int>(cur_x_, (int)buffer_[(std::size_t)cur_y_].size()); }
-                else if (ch=='k'){ if (cur_y_>0) cur_y_--; cur_x_ = std::min<int>(cur_x_, (int)buffer_[(std::size_t)cur_y_].size()); }
-                else if (ch=='l'){ if (cur_x_ < (int)buffer_[(std::size_t)cur_y_].size()) cur_x_++; else if (cur_y_<(int)buffer_.size()-1){ cur_y_++; cur_x_=0; } }
+                if (ch== 'h') { if (cur_x_>0) cur_x_--; else if (cur_y_>0){ cur_y_--; cur_x_ = line_len(cur_y_); } }
+                else if (ch=='j'){ if (cur_y_<line_count()-1) cur_y_++; cur_x_ = std::min<int>(cur_x_, line_len(cur_y_)); }
+                else if (ch=='k'){ if (cur_y_>0) cur_y_--; cur_x_ = std::min<int>(cur_x_, line_len(cur_y_)); }
+                else if (ch=='l'){ if (cur_x_ < line_len(cur_y_)) cur_x_++; else if (cur_y_<line_count()-1){ cur_y_++; cur_x_=0; } }
                 else if (ch >= 32 && ch <= 126) insert_char((char)ch);
                 break;
         }
-        cur_y_ = std::clamp<int>(cur_y_, 0, (int)buffer_.size()-1);
-        cur_x_ = std::clamp<int>(cur_x_, 0, (int)buffer_[(std::size_t)cur_y_].size());
+        cur_y_ = std::clamp<int>(cur_y_, 0, line_count()-1);
+        cur_x_ = std::clamp<int>(cur_x_, 0, line_len(cur_y_));
     }
 
     // ---- command mode ----
+    // one input batch of command-line keys; run() draws the frame afterwards
     bool command_loop(){
-        status_ = ":" + cmdbuf_;
-        draw();
-        int ch = _getch();
-        if (ch == 27) { mode_="EDIT"; status_=""; cmdbuf_.clear(); return false; } // ESC
-        if (ch == 8)   { if (!cmdbuf_.empty()) cmdbuf_.pop_back(); return false; } // backspace
-        if (ch == '\r' || ch=='\n'){
-            bool quit = execute_command(cmdbuf_); cmdbuf_.clear();
-            mode_ = "EDIT";
-            return quit;
-        }
-        if (ch==':' && cmdbuf_.empty()) return false; // leading ':' implicit
-        if (ch >= 32 && ch <= 126) cmdbuf_.push_back((char)ch);
+        for (int ch = read_key(); ch >= 0; ch = pending_key()) {
+            if (ch == 27) { mode_="EDIT"; status_=""; cmdbuf_.clear(); return false; } // ESC
+            if (ch == '\r' || ch=='\n'){
+                bool quit = execute_command(cmdbuf_); cmdbuf_.clear();
+                mode_ = "EDIT";
+                return quit;
+            }
+            if (ch == 8) { if (!cmdbuf_.empty()) cmdbuf_.pop_back(); } // backspace
+            else if (ch == 224) input_.get(); // arrows etc. do nothing on the command line
+            else if (ch==':' && cmdbuf_.empty()) {} // leading ':' implicit
+            else if (ch >= 32 && ch <= 126) cmdbuf_.push_back((char)ch);
+        }
+        status_.assign(":").append(cmdbuf_);
         return false;
     }
 
     // ---- open/save ----
     void open_file(const std::string& path){
-        auto s = read_text_file(path);
-        buffer_.clear();
-        if (!s) { buffer_.push_back(""); status_ = "New file: " + path; }
-        else {
-            std::string text = *s, line; std::istringstream iss(text);
-            while (std::getline(iss, line)) { if (!line.empty() && line.back()=='\r') line.pop_back(); buffer_.push_back(line); }
-            if (text.size() && text.back()=='\n' && (buffer_.empty() || !buffer_.back().empty())) buffer_.push_back("");
-            status_ = "Opened " + path;
-        }
+        if (swap_) swap_->discard();
+        status_ = (load_buffer(path) ? "Opened " : "New file: ") + path;
         filename_ = path; cur_y_=cur_x_=off_y_=off_x_=0; dirty_=false;
+        undo_.clear(); reset_stats(); stop_search();
+        attach_swap(); reset_highlight();
+    }
+    void reset_highlight(){ hl_on_ = syntax_ && is_cpp_file(filename_); hl_.reset(); }
+    // Journal this buffer's edits to its swap file, unless a crashed
+    // session left one there: that waits for :recover.
+    void attach_swap(){
+        if (!journal_) return;
+        swap_ = std::make_unique<SwapFile>(SwapFile::path_for(filename_), file_stamp(filename_));
+        if (auto j = SwapFile::read(swap_->path()); j && !j->edits.empty()) {
+            swap_->hold();
+            status_ += " (swap file found: :recover replays it, :recover discard deletes it)";
+        }
+    }
+    // :recover [discard] / :recover! — replay the held swap file onto the
+    // buffer (the edits can be undone), or delete it
+    void command_recover(std::string_view arg, bool force){
+        if (!swap_ || !swap_->held()) { status_ = "recover: no swap file waiting for " + filename_; return; }
+        if (arg == "discard") { swap_->release(); swap_->discard(); attach_swap(); status_ = "recover: swap file deleted."; return; }
+        auto j = SwapFile::read(swap_->path());
+        if (!j) { status_ = "recover: cannot read " + swap_->path(); return; }
+        if (!force && j->base != file_stamp(filename_)) {
+            status_ = "recover: " + filename_ + " changed since the swap file was written (:recover! replays anyway).";
+            return;
+        }
+        buffer_->ensure_indexed();
+        std::size_t applied = 0, valid = sizeof(SwapFileHeader);
+        for (const auto& e : j->edits) {
+            if (e.pos > buffer_->size() || e.del_len > buffer_->size() - e.pos) break;
+            edit_replace(e.pos, e.del_len, e.inserted);   // held: not journaled again
+            move_to_offset(e.pos + e.inserted.size());
+            valid = e.end; ++applied;
+        }
+        undo_.seal();
+        swap_->resume(valid);   // later edits append after the replayed records
+        status_ = "recover: replayed " + std::to_string(applied) + " of " + std::to_string(j->edits.size()) + " changes (:w keeps them).";
+    }
+    void reset_stats(){ live_.invalidate(); if (hud_) live_.start(); }
+    bool load_buffer(const std::string& path){
+        col_index_.clear();
+        MappedFile mf;
+        if (mf.open(path)) { buffer_->reset(std::move(mf)); return true; }
+        if (auto s = read_text_file(path)) { buffer_->reset(std::move(*s)); return true; }
+        buffer_->reset(std::string()); return false;
     }
     void save_file(const std::string& path){
-        std::ostringstream oss;
-        for (std::size_t i=0;i<buffer_.size();++i){ oss << buffer_[i]; if (i+1<buffer_.size()) oss << '\n'; }
-        if (write_text_file(path, oss.str())) { filename_ = path; status_ = "Saved " + path; dirty_=false; }
-        else status_ = "Error: could not save " + path;
+        // pieces stream straight from the mapping / add buffer into the writer
+        std::string tmp = path + ".~tmp";
+        bool ok = write_temp_file(tmp, [&](FileWriter& w){
+            bool good = true;
+            buffer_->for_each_chunk([&](std::string_view v){ good = good && w.write(v); });
+            return good;
+        });
+        if (!ok) { status_ = "Error: could not save " + path; return; }
+        bool over_mapped = buffer_->mapped() && path == filename_;
+        if (over_mapped) { search_job_.cancel(); buffer_->detach(); }
+        if (!replace_with_temp(tmp, path)) {
+            if (over_mapped && !buffer_->reattach(path)) { load_buffer(path); reset_stats(); }
+            status_ = "Error: could not replace " + path;
+            return;
+        }
+        // the file now holds exactly the document: map it as the new original
+        if (over_mapped) load_buffer(path);
+        if (swap_) swap_->discard();   // the file holds every journaled edit now
+        filename_ = path; status_ = "Saved " + path; dirty_=false;
+        attach_swap(); reset_highlight();
     }
 
-    // ---- shell + compile/run ----
-    std::string run_shell_capture(const std::string& cmd){
-        std::string full = "powershell -NoProfile -Command \"" + cmd + "\"";
-        FILE* pipe = _popen(full.c_str(), "r");
-        if (!pipe) return "Error: shell failed.";
-        std::string out; char buf[4096];
-        for(;;){ std::size_t n=fread(buf,1,sizeof(buf),pipe); if(n>0) out.append(buf,buf+n); if(n<sizeof(buf)) break; }
-        _pclose(pipe); return out;
+    // ---- buffers ----
+    // :e <file>: switch to the buffer holding it, or open it in a new one
+    void edit_file(const std::string& path){
+        if (path == filename_) { status_ = "Already editing " + path; return; }
+        for (std::size_t i = 0; i < bufs_.size(); ++i)
+            if (i != cur_buf_ && bufs_[i].filename == path) { switch_buffer(i); return; }
+        bufs_.emplace_back().filename = path;   // loads like an evicted buffer
+        switch_buffer(bufs_.size() - 1);
+    }
+    void switch_buffer(std::size_t i){
+        if (i == cur_buf_ || i >= bufs_.size()) return;
+        stop_search();   // match offsets belong to the buffer being parked
+        ParkedBuffer& out = bufs_[cur_buf_];
+        out.text = std::move(buffer_); out.filename = std::move(filename_); out.dirty = dirty_;
+        out.cur_y = cur_y_; out.cur_x = cur_x_; out.off_y = off_y_; out.off_x = off_x_;
+        out.undo = std::move(undo_); undo_ = UndoLog();
+        out.swap = std::move(swap_);
+        out.used = ++buf_tick_;
+        ParkedBuffer& in = bufs_[i];
+        filename_ = std::move(in.filename); dirty_ = in.dirty;
+        cur_y_ = in.cur_y; cur_x_ = in.cur_x; off_y_ = in.off_y; off_x_ = in.off_x;
+        undo_ = std::move(in.undo); in.undo = UndoLog();
+        swap_ = std::move(in.swap);
+        cur_buf_ = i; col_index_.clear(); reset_highlight();
+        if (in.text) { buffer_ = std::move(in.text); status_ = filename_; }
+        else {
+            buffer_ = std::make_unique<PieceTable>();
+            status_ = (load_buffer(filename_) ? "Opened " : "New file: ") + filename_;
+            // the file may have changed since it was evicted
+            buffer_->ensure_lines((std::size_t)cur_y_ + 1);
+            cur_y_ = std::clamp(cur_y_, 0, line_count() - 1);
+            cur_x_ = std::clamp(cur_x_, 0, line_len(cur_y_));
+        }
+        if (!swap_) attach_swap();
+        status_ = "[" + std::to_string(i + 1) + "/" + std::to_string(bufs_.size()) + "] " + status_;
+        reset_stats();
+        enforce_budget();
+    }
+    // drop least recently shown, unmodified, mapped buffers until the total fits
+    void enforce_budget(){
+        std::size_t total = buffer_->footprint();
+        for (auto& b : bufs_) if (b.text) total += b.text->footprint();
+        while (total > mem_budget_) {
+            ParkedBuffer* victim = nullptr;
+            for (auto& b : bufs_)
+                if (b.text && !b.dirty && b.text->mapped() && (!victim || b.used < victim->used)) victim = &b;
+            if (!victim) break;
+            total -= victim->text->footprint();
+            victim->text.reset(); victim->undo.clear();   // the journal would not survive an outside change
+            if (victim->swap) victim->swap->discard();
+            victim->swap.reset();
+        }
     }
+    // quitting: every buffer's journal goes (held ones from a crash stay)
+    void discard_swaps(){
+        if (swap_) swap_->discard();
+        for (auto& b : bufs_) if (b.swap) b.swap->discard();
+    }
+    bool any_dirty() const { return dirty_ || std::any_of(bufs_.begin(), bufs_.end(), [](const ParkedBuffer& b){ return b.dirty; }); }
+    // :ls — every buffer with its state and resident size
+    void list_buffers(){
+        report_.clear();
+        for (std::size_t i = 0; i < bufs_.size(); ++i) {
+            bool here = i == cur_buf_;
+            const PieceTable* t = here ? buffer_.get() : bufs_[i].text.get();
+            char row[64], mem[32] = "evicted";
+            std::snprintf(row, sizeof(row), "%3zu %c%c ", i + 1, here ? '%' : ' ', (here ? dirty_ : bufs_[i].dirty) ? '+' : ' ');
+            if (t) std::snprintf(mem, sizeof(mem), "%.1f MB", double(t->footprint()) / double(1 << 20));
+            report_.push_back(row + (here ? filename_ : bufs_[i].filename) + "  (" + mem + ")");
+        }
+        report_title_ = "buffers (budget " + std::to_string(mem_budget_ >> 20) + " MB, :budget <MB>)";
+        pane_ = Pane::REPORT; out_visible_ = true;
+        status_.clear();
+    }
+
+    // ---- shell + compile/run ----
     void command_shell(const std::string& cmd){
-        status_ = "Executing: " + (cmd.size()>40? cmd.substr(0,40)+"..." : cmd);
-        draw();
-        auto out = trim_copy(run_shell_capture(cmd));
-        if (out.empty()) status_ = "Command produced no output.";
-        else { insert_text_block(out); status_="Command finished."; }
+        PERF_SCOPE(":!");
+        if (job_ && job_->running()) { status_ = "A command is still running (:kill cancels it)."; return; }
+        job_ = std::make_unique<ShellJob>();
+        shell_out_.reset(std::string()); pane_ = Pane::SHELL;
+        if (!job_->start("powershell -NoProfile -Command \"" + cmd + "\"")) { job_.reset(); status_ = "Error: shell failed."; return; }
+        job_cmd_ = cmd.size()>40? cmd.substr(0,40)+"..." : cmd;
+        job_pending_ = true; out_visible_ = true;
+        status_ = "Executing: " + job_cmd_;
     }
+    // Binaries are cached in %TEMP% under a hash of the buffer bytes and the
+    // flags, so an unchanged buffer runs without recompiling. With pch on,
+    // the standard library comes from a precompiled header built once.
+    // The compiler runs in the background; its output goes to the quickfix
+    // list, never into the document. It links to a temp name that is renamed
+    // into place, so a killed build never leaves a truncated binary behind
+    // as a cache hit.
     void command_cpp(){
-        status_="Compiling C++23…"; draw();
+        PERF_SCOPE(":cpp");
+        if (cpp_job_) { status_="A build is already running."; return; }
+        if (job_ && job_->running()) { status_ = "A command is still running (:kill cancels it)."; return; }
         char tmpPath[MAX_PATH]; GetTempPathA(MAX_PATH, tmpPath);
         std::string tmpdir = tmpPath;
+        std::string flags = "-std=c++23";
+        if (cpp_pch_ && ensure_cpp_pch(tmpdir)) flags += " -Winvalid-pch -include \"" + tmpdir + "vimified_pch.hpp\"";
+        std::uint64_t h = fnv1a64(FNV1A64_OFFSET, flags);
+        buffer_->for_each_chunk([&](std::string_view v){ h = fnv1a64(h, v); });
+        char key[17]; std::snprintf(key, sizeof(key), "%016llx", (unsigned long long)h);
+        std::string exe = tmpdir + "vimified_" + key + ".exe";
+        if (GetFileAttributesA(exe.c_str()) != INVALID_FILE_ATTRIBUTES) { run_cpp_binary(exe, " [cached build]"); return; }
         std::string src = tmpdir + "vimified_main.cpp";
-        std::string exe = tmpdir + "vimified_run.exe";
-        // dump buffer to src
-        std::ostringstream oss; for (auto& l : buffer_) oss << l << '\n';
-        if (!write_text_file(src, oss.str())) { status_="Failed to write temp source."; return; }
-        // compile & run
-        std::string ccmd = "g++ -std=c++23 \"" + src + "\" -o \"" + exe + "\"";
-        auto compile_out = run_shell_capture(ccmd);
-        auto run_out     = run_shell_capture("\"" + exe + "\"");
-        if (!trim_copy(run_out).empty()) { insert_text_block(trim_copy(run_out)); status_="Program ran (output inserted)."; }
-        else if (!trim_copy(compile_out).empty()) { insert_text_block(trim_copy(compile_out)); status_="Compilation failed (diagnostics inserted)."; }
-        else status_="Program produced no output.";
+        bool wrote = write_temp_file(src, [&](FileWriter& w){
+            bool good = true;
+            buffer_->for_each_chunk([&](std::string_view v){ good = good && w.write(v); });
+            return good && w.write("\n");
+        });
+        if (!wrote) { status_="Failed to write temp source."; return; }
+        std::string built = tmpdir + "vimified_" + key + ".~tmp.exe";
+        cpp_job_ = std::make_unique<ShellJob>();
+        if (!cpp_job_->start("g++ " + flags + " \"" + src + "\" -o \"" + built + "\"")) {
+            cpp_job_.reset(); status_="Error: could not start g++."; return;
+        }
+        qf_.reset(); cpp_src_ = src; cpp_building_ = exe; cpp_linked_ = built;
+        pane_ = Pane::QUICKFIX; out_visible_ = true;
+        status_="Compiling C++23…";
+    }
+    // the compiler exited: settle the quickfix list, then run or report
+    void finish_cpp_build(){
+        qf_.feed(cpp_job_->poll()); qf_.finish();
+        int code = cpp_job_->exit_code();
+        bool cancelled = cpp_job_->cancelled();
+        cpp_job_.reset();
+        std::string exe = std::move(cpp_building_), built = std::move(cpp_linked_);
+        if (code != 0 || !replace_with_temp(built, exe)) {
+            DeleteFileA(built.c_str());
+            if (cancelled) { status_ = "Build cancelled."; return; }
+            std::string head = "Compilation failed: " + std::to_string(qf_.errors()) + " errors";
+            if (const auto* e = qf_.next()) { jump_to(*e); status_ = head + " | " + status_; }
+            else status_ = head + " (:out to view compiler output).";
+            return;
+        }
+        run_cpp_binary(exe, qf_.warnings() ? " [" + std::to_string(qf_.warnings()) + " warnings]" : "");
+    }
+    // The program runs in the background like a :! command, its output
+    // streaming into the shell pane (:kill stops it, :out put inserts it).
+    void run_cpp_binary(const std::string& exe, const std::string& note){
+        if (auto it = std::find(cpp_builds_.begin(), cpp_builds_.end(), exe); it != cpp_builds_.end()) cpp_builds_.erase(it);
+        cpp_builds_.push_back(exe);
+        if (cpp_builds_.size() > CPP_BUILDS_KEPT) { DeleteFileA(cpp_builds_.front().c_str()); cpp_builds_.pop_front(); }
+        if (job_ && job_->running()) { status_ = "A command is still running (:kill cancels it)." + note; return; }
+        job_ = std::make_unique<ShellJob>();
+        shell_out_.reset(std::string()); pane_ = Pane::SHELL;
+        if (!job_->start("\"" + exe + "\"")) { job_.reset(); status_ = "Error: could not run " + exe; return; }
+        job_cmd_ = exe.substr(exe.find_last_of("\\/") + 1);
+        job_pending_ = true; out_visible_ = true;
+        status_ = "Running " + job_cmd_ + note;
+    }
+    // Diagnostics in the compiled buffer move the cursor; others (headers) are only reported.
+    void jump_to(const QuickfixList::Entry& e){
+        std::string_view f = qf_.file(e);
+        bool here = f == cpp_src_ || f.ends_with("vimified_main.cpp");
+        std::string where = here ? "" : std::string(f) + ":" + std::to_string(e.line) + ": ";
+        status_ = where + QuickfixList::severity_name(e.sev) + ": " + std::string(qf_.message(e));
+        if (!here) return;
+        cur_y_ = std::clamp<int>((int)e.line - 1, 0, line_count()-1);
+        cur_x_ = std::clamp<int>((int)e.col - 1, 0, line_len(cur_y_));
+    }
+    // :repl [exe] | :repl stop | :eval [all]
+    void command_repl(const Words& parts){
+        if (parts.size()>=2 && parts[1]=="stop"){ repl_.stop(); status_="REPL stopped."; return; }
+        if (parts.size()>=2) repl_exe_ = std::string(parts[1]);
+        if (!repl_.start(repl_exe_)) { status_="Error: could not start " + repl_exe_; return; }
+        shell_out_.reset(std::string()); pane_ = Pane::REPL; out_visible_ = true;
+        status_="REPL started (:eval sends the current line, :eval all the buffer).";
+    }
+    void command_eval(bool all){
+        if (!repl_.alive() && !repl_.start(repl_exe_)) { status_="Error: could not start " + repl_exe_ + " (:repl <path>)"; return; }
+        if (pane_ != Pane::REPL) { shell_out_.reset(std::string()); pane_ = Pane::REPL; }
+        out_visible_ = true;
+        std::string snippet = all ? buffer_->text() : buffer_->line((std::size_t)cur_y_);
+        if (trim_copy(snippet).empty()) { status_="Nothing to evaluate."; return; }
+        status_ = repl_.eval(snippet) ? "Evaluating…" : "Error: REPL is not accepting input.";
+    }
+    bool ensure_cpp_pch(const std::string& tmpdir){
+        std::string hdr = tmpdir + "vimified_pch.hpp", gch = hdr + ".gch";
+        if (GetFileAttributesA(gch.c_str()) != INVALID_FILE_ATTRIBUTES) return true;
+        status_="Building precompiled header…"; draw();
+        if (!write_text_file(hdr, "#include <bits/stdc++.h>\n")) return false;
+        int code = 0;
+        run_capture("g++ -std=c++23 -x c++-header \"" + hdr + "\" -o \"" + gch + "\"", code);
+        if (code != 0) { DeleteFileA(gch.c_str()); return false; }
+        return true;
     }
 
     // ---- buffer insertion ----
-    void insert_text_block(const std::string& text){
+    void insert_text_block(std::string_view text, bool typing = false){
         if (text.empty()) return;
-        std::vector<std::string> lines; { std::string s; s.reserve(text.size());
-            for (char c: text){ if (c=='\n'){ lines.push_back(s); s.clear(); } else if (c!='\r'){ s.push_back(c);} }
-            lines.push_back(s);
+        // one splice into the piece table; line breaks follow the file's EOL style
+        std::string& block = block_; block.clear();
+        int nl = 0, last = 0;
+        for (char c: text){
+            if (c=='\n'){ block += buffer_->eol(); nl++; last = 0; }
+            else if (c!='\r'){ block.push_back(c); last++; }
+        }
+        edit_insert(cursor_offset(), block, typing); release_large(block);
+        if (nl) { cur_y_ += nl; cur_x_ = last; } else cur_x_ += last;
+    }
+
+    // ---- search ----
+    // line-aligned runs of about SEARCH_UNIT bytes covering [from, to) (both
+    // line starts); runs inside the original are views, the rest are copies
+    // kept in `owned`
+    void add_search_units(std::vector<SearchJob::Unit>& units, std::size_t from, std::size_t to, std::deque<std::string>& owned){
+        for (std::size_t at = from; at < to; ) {
+            std::size_t want = at + SEARCH_UNIT;
+            std::size_t end = want >= to ? to : buffer_->line_start(buffer_->line_of(want) + 1);
+            units.push_back({at, buffer_->span(at, end - at, owned)});
+            at = end;
         }
-        std::string tail = buffer_[(std::size_t)cur_y_].substr((std::size_t)cur_x_);
-        buffer_[(std::size_t)cur_y_] =
-          buffer_[(std::size_t)cur_y_].substr(0,(std::size_t)cur_x_) + lines.front();
-        for (std::size_t i=1;i<lines.size();++i) buffer_.insert(buffer_.begin()+ (cur_y_ + (int)i), lines[i]);
-        cur_y_ += (int)lines.size() - 1; cur_x_ = (int)buffer_[(std::size_t)cur_y_].size();
-        buffer_[(std::size_t)cur_y_] += tail; dirty_ = true;
+    }
+    std::vector<SearchJob::Unit> search_units(std::deque<std::string>& owned){
+        buffer_->ensure_indexed();
+        std::vector<SearchJob::Unit> units;
+        if (!index_on_ || !trigrams_.built()) { add_search_units(units, 0, buffer_->size(), owned); return units; }
+        // the index's units: clean ones as they are, edited ones cut afresh
+        for (auto& sp : trigrams_.spans()) {
+            if (sp.dirty) add_search_units(units, sp.off, sp.off + sp.len, owned);
+            else units.push_back({sp.off, buffer_->span(sp.off, sp.len, owned)});
+        }
+        return units;
+    }
+    // the running scan and its matches (their offsets go stale with any edit)
+    void cancel_search(){ search_job_.cancel(); matches_.clear(); search_jump_ = false; }
+    void stop_search(){ cancel_search(); trigrams_.clear(); }
+    // /pattern: compile, then scan the buffer on the worker pool
+    void start_search(std::string_view pattern){
+        PERF_SCOPE("/search");
+        auto pat = std::make_shared<SearchPattern>();
+        std::string err;
+        if (!pat->compile(pattern, err)) { status_ = "search: " + err; return; }
+        search_pat_ = std::move(pat); search_src_ = pattern;
+        run_search();
+    }
+    void run_search(){
+        search_job_.cancel(); matches_.clear();
+        std::deque<std::string> owned;
+        auto units = search_units(owned);
+        std::string_view lit = search_pat_->literal() ? search_pat_->literal_text() : std::string_view();
+        if (index_on_) trigrams_.build(units);   // hashes only the units it does not hold yet
+        if (index_on_ && lit.size() >= 3) {
+            std::erase_if(units, [&, i = std::size_t(0)](const SearchJob::Unit&) mutable { return !trigrams_.may_contain(i++, lit); });
+        }
+        search_job_.start(search_pat_, std::move(units), std::move(owned));
+        search_jump_ = true;
+        poll_search();
+    }
+    // adopt finished units; true when something on screen may have changed
+    bool poll_search(){
+        auto got = search_job_.poll();
+        bool changed = !got.empty();
+        matches_.insert(matches_.end(), got.begin(), got.end());
+        bool done = !search_job_.running();
+        if (search_jump_) {
+            // first match after the cursor, or (once the scan is over) wrap to the top
+            std::size_t cur = cursor_offset();
+            auto it = std::upper_bound(matches_.begin(), matches_.end(), cur, [](std::size_t p, const SearchPattern::Match& m){ return p < m.first; });
+            if (it != matches_.end()) { move_to_offset(it->first); search_jump_ = false; }
+            else if (done && !matches_.empty()) { move_to_offset(matches_.front().first); search_jump_ = false; }
+        }
+        status_ = "/" + search_src_ + ": " + std::to_string(matches_.size()) + " matches"
+                + (done ? "" : " (" + std::to_string(search_job_.progress_percent()) + "%)");
+        if (done) search_jump_ = false;
+        return changed || done;
+    }
+    // :n / :N — after an edit cleared the matches, search again for the same pattern
+    void next_match(bool forward){
+        if (!search_pat_) { status_ = "No previous search (/pattern)."; return; }
+        if (matches_.empty()) {
+            if (!search_job_.running()) run_search();
+            return;
+        }
+        std::size_t cur = cursor_offset();
+        auto it = forward
+            ? std::upper_bound(matches_.begin(), matches_.end(), cur, [](std::size_t p, const SearchPattern::Match& m){ return p < m.first; })
+            : std::lower_bound(matches_.begin(), matches_.end(), cur, [](const SearchPattern::Match& m, std::size_t p){ return m.first < p; });
+        bool wrapped = forward ? it == matches_.end() : it == matches_.begin();
+        if (forward) it = wrapped ? matches_.begin() : it;
+        else it = wrapped ? matches_.end() - 1 : it - 1;
+        move_to_offset(it->first);
+        status_ = "/" + search_src_ + ": match " + std::to_string(std::size_t(it - matches_.begin()) + 1) + " of "
+                + std::to_string(matches_.size()) + (search_job_.running() ? " so far" : "") + (wrapped ? " (wrapped)" : "");
+    }
+    // :[%]s/pat/rep/[g] — the current line, or every line with %. In the
+    // replacement & is the match, \& a literal & and \\ a backslash. The
+    // whole substitution is one edit (one undo step) over the changed range.
+    void substitute(bool whole, std::string_view pattern, std::string_view rep, bool global){
+        PERF_SCOPE(":s");
+        SearchPattern pat;
+        std::string err;
+        if (!pat.compile(pattern, err)) { status_ = "s: " + err; return; }
+        std::vector<SearchPattern::Match> found;
+        if (whole) {
+            std::deque<std::string> owned;
+            auto units = search_units(owned);
+            std::vector<std::vector<SearchPattern::Match>> per(units.size());
+            parallel_for(units.size(), [&](std::size_t i){ SearchPattern::Scratch sc; search_unit(pat, units[i].off, units[i].text, sc, per[i]); });
+            for (auto& v : per) found.insert(found.end(), v.begin(), v.end());
+        } else {
+            std::size_t ls = buffer_->line_start((std::size_t)cur_y_);
+            SearchPattern::Scratch sc;
+            search_unit(pat, ls, buffer_->line((std::size_t)cur_y_), sc, found);
+        }
+        if (found.empty()) { status_ = "s: pattern not found"; return; }
+        std::size_t from = found.front().first, to = found.back().first + found.back().second;
+        std::string seg = buffer_->substr(from, to - from), out;
+        out.reserve(seg.size());
+        std::size_t at = 0, count = 0, last = 0;   // last: where the final replacement starts in out
+        bool line_done = false;
+        for (auto [pos, len] : found) {
+            std::size_t a = pos - from;
+            // without g only the first match of each line is replaced
+            if (line_done && !global) {
+                if (!std::memchr(seg.data() + at, '\n', a - at)) continue;
+            }
+            out.append(seg, at, a - at);
+            last = out.size();
+            for (std::size_t i = 0; i < rep.size(); ++i) {
+                if (rep[i] == '\\' && i + 1 < rep.size()) out.push_back(rep[++i]);
+                else if (rep[i] == '&') out.append(seg, a, len);
+                else out.push_back(rep[i]);
+            }
+            at = a + len; count++; line_done = true;
+        }
+        out.append(seg, at, std::string::npos);
+        edit_replace(from, seg.size(), out);
+        undo_.seal();
+        move_to_offset(from + last);
+        status_ = std::to_string(count) + " substitution" + (count == 1 ? "" : "s") + ".";
+    }
+
+    // pat/rep/[g] after the "s/" or "%s/"; \/ stands for a '/' inside pat or rep
+    void command_substitute(std::string_view spec, bool whole){
+        std::string field[3];
+        int f = 0;
+        for (std::size_t i = 0; i < spec.size(); ++i) {
+            if (spec[i] == '/' && f < 2) { f++; continue; }
+            if (spec[i] == '\\' && i + 1 < spec.size() && spec[i+1] == '/') i++;
+            else if (spec[i] == '\\' && i + 1 < spec.size()) field[f].push_back(spec[i++]);
+            field[f].push_back(spec[i]);
+        }
+        if (f < 1 || (field[2] != "" && field[2] != "g")) { status_ = "Usage: :[%]s/pattern/replacement/[g]"; return; }
+        substitute(whole, field[0], field[1], field[2] == "g");
     }
 
     // ---- :tok ----
+    // stats of the buffer: one full pass the first time, then maintained by splice()
+    const TokenStats& buffer_stats(){
+        if (!live_.valid()) { buffer_->ensure_indexed(); live_.rebuild(buffer_->text()); }
+        return live_.stats();
+    }
     void tok_stats(std::optional<std::string> path_opt){
-        std::string content;
-        if (path_opt){ auto s = read_text_file(*path_opt); if(!s){ status_="tok: cannot open "+*path_opt; return;} content=*s; }
-        else { std::ostringstream oss; for (std::size_t i=0;i<buffer_.size();++i){ oss<<buffer_[i]; if(i+1<buffer_.size()) oss<<'\n'; } content=oss.str(); }
-        auto st = compute_token_stats(content);
+        PERF_SCOPE(":tok stats");
+        // files are analysed in place through a mapping; chunks go to the worker pool
+        std::string content; MappedFile mf; std::string_view text;
+        TokenStats file_st;
+        if (path_opt) {
+            if (mf.open(*path_opt)) text = mf.view();
+            else { auto s = read_text_file(*path_opt); if(!s){ status_="tok: cannot open "+*path_opt; return;} content=std::move(*s); text=content; }
+            file_st = compute_token_stats(text);
+        }
+        const TokenStats& st = path_opt ? file_st : buffer_stats();
         std::ostringstream js;
         js << "{\n"
            << "  \"lines\": " << st.lines << ",\n"
@@ -462,77 +4046,218 @@ private:
         insert_text_block(js.str()); status_="Token stats inserted.";
     }
     void tok_ngram(std::size_t N, std::size_t K){
+        PERF_SCOPE(":tok ngram");
         if (!N){ status_="tok: N must be >=1"; return; }
-        std::string content; for (auto& l: buffer_) { content+=l; content+='\n'; }
-        auto toks = tokenize_words(content);
-        auto res  = top_ngrams(toks, N, K);
+        std::string content = buffer_->text();
+        TokenInterner in;
+        auto ids  = intern_words(content, in);
+        auto res  = top_ngrams(ids, in, N, K);
         std::ostringstream oss; oss << "Top " << K << " " << N << "-grams:\n";
         for (auto& [ng,cnt] : res){ oss << "  "; for (std::size_t i=0;i<ng.size();++i){ if(i) oss<<' '; oss<<ng[i]; } oss << "  -> " << cnt << "\n"; }
         insert_text_block(oss.str()); status_="N-grams inserted.";
     }
-    void tok_export(const std::string& outpath){
-        std::ostringstream oss; for (std::size_t i=0;i<buffer_.size();++i){ oss<<buffer_[i]; if(i+1<buffer_.size()) oss<<'\n'; }
-        auto st = compute_token_stats(oss.str());
-        std::ostringstream js;
-        js << "{\n"
-           << "  \"file\": \"" << json_escape(outpath) << "\",\n"
-           << "  \"lines\": " << st.lines << ",\n"
-           << "  \"chars\": " << st.chars << ",\n"
-           << "  \"tokens\": " << st.tokens << ",\n"
-           << "  \"unique_tokens\": " << st.unique_tokens << ",\n"
-           << "  \"type_token_ratio\": " << st.ttr << ",\n"
-           << "  \"avg_token_length\": " << st.avg_token_len << ",\n"
-           << "  \"char_entropy_bits\": " << st.char_entropy << ",\n"
-           << "  \"token_entropy_bits\": " << st.token_entropy << ",\n"
-           << "  \"freq\": {";
-        bool first=true;
-        for (auto& [tok,cnt] : st.freq){ if(!first) js<<","; first=false; js << "\n    \"" << json_escape(tok) << "\": " << cnt; }
-        if (!st.freq.empty()) js << "\n  ";
-        js << "}\n}\n";
-        if (write_text_file(outpath, js.str())) status_="Exported token stats -> "+outpath;
-        else status_="tok: export failed";
+    // corpus totals go to the report pane rather than into the buffer
+    void tok_corpus(const std::string& spec, std::size_t N, std::size_t K){
+        PERF_SCOPE(":tok corpus");
+        if (!N){ status_="tok: N must be >=1"; return; }
+        auto t0 = std::chrono::steady_clock::now();
+        auto files = corpus_files(spec);
+        if (files.empty()) { status_="tok: no files match "+spec; return; }
+        CorpusStats cs = corpus_stats(files, N, tok_cache_dir());
+        const TokenStats& st = cs.stats;
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        char line[160];
+        report_.clear();
+        std::snprintf(line, sizeof(line), "files %zu (%zu cached, %zu unreadable)  %.1f MB  %.0f ms",
+                      cs.files, cs.cached, cs.unreadable, cs.bytes / 1048576.0, ms);
+        report_.push_back(line);
+        std::snprintf(line, sizeof(line), "tokens %zu  unique %zu  ttr %.4f  avg len %.2f  entropy %.3f bits (chars %.3f)",
+                      st.tokens, st.unique_tokens, st.ttr, st.avg_token_len, st.token_entropy, st.char_entropy);
+        report_.push_back(line);
+        auto list = [&](const char* what, const TokenFreq& f){
+            report_.push_back("");
+            report_.push_back("top " + std::to_string(K) + " " + what + ":");
+            for (auto& [t, c] : top_freq(f, K)) report_.push_back("  " + std::string(t) + "  -> " + std::to_string(c));
+        };
+        list("tokens", st.freq);
+        if (N >= 2) list((std::to_string(N) + "-grams").c_str(), cs.grams);
+        report_title_ = "tok corpus " + spec;
+        pane_ = Pane::REPORT; out_visible_ = true;
+        std::snprintf(line, sizeof(line), "tok corpus: %zu files, %zu from cache, %.0f ms", cs.files, cs.cached, ms);
+        status_ = line;
+    }
+    // JSON, or the columnar binary layout for "bin" / a .bin or .tokbin path
+    void tok_export(const std::string& outpath, std::string format){
+        PERF_SCOPE(":tok export");
+        if (format.empty()) format = (outpath.ends_with(".bin") || outpath.ends_with(".tokbin")) ? "bin" : "json";
+        if (format != "json" && format != "bin") { status_="tok: export format is json or bin"; return; }
+        const TokenStats& st = buffer_stats();
+        std::string tmp = outpath + ".~tmp";
+        bool ok = write_temp_file(tmp, [&](FileWriter& w){
+            return format == "bin" ? write_token_stats_bin(w, st) : write_token_stats_json(w, st, outpath);
+        }) && replace_with_temp(tmp, outpath);
+        status_ = ok ? "Exported token stats (" + format + ") -> " + outpath : "tok: export failed";
     }
-    void tok_perm(std::uint64_t len, std::uint64_t limit){
-        const std::uint64_t MAXL=5000; if (limit>MAXL) limit=MAXL;
-        auto out = compose_permutations(len, limit);
-        if (out.empty()) { status_="tok: no permutations"; return; }
-        insert_text_block(out); status_="Permutations inserted.";
+    // Into the buffer the count stays capped; with a file there is no cap and
+    // the strings stream out in large blocks.
+    void tok_perm(std::uint64_t len, std::uint64_t limit, const std::string& outpath,
+                  std::string_view alphabet, std::uint64_t start){
+        PERF_SCOPE(":tok perm");
+        if (len > PermutationStream::MAX_LEN) { status_="tok: perm len is at most " + std::to_string(PermutationStream::MAX_LEN); return; }
+        if (outpath.empty()) {
+            const std::uint64_t MAXL=5000, MAXBYTES=std::uint64_t(64)<<20;
+            if (limit>MAXL) limit=MAXL;
+            // divided, not multiplied: (len+1)*limit could wrap
+            if (len && limit && len + 1 > MAXBYTES / limit) { status_="tok: too large to insert, give an output file"; return; }
+            auto out = compose_permutations(alphabet, len, start, limit);
+            if (out.empty()) { status_="tok: no permutations"; return; }
+            insert_text_block(out); status_="Permutations inserted.";
+            return;
+        }
+        PermutationStream ps(alphabet, (std::size_t)len, start, limit);
+        std::uint64_t n = ps.remaining();
+        FileWriter w;
+        auto t0 = std::chrono::steady_clock::now();
+        bool ok = w.open(outpath) && stream_permutations(w, ps);
+        ok = w.close() && ok;
+        double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        char msg[128];
+        std::snprintf(msg, sizeof(msg), " (%llu strings, %.0f MB/s)", (unsigned long long)n,
+                      s > 0 ? double(n) * double(ps.line_width()) / s / 1e6 : 0.0);
+        status_ = ok ? "Permutations -> " + outpath + msg : "tok: cannot write " + outpath;
+    }
+
+    // :perf | :perf reset | :perf trace <file.json>
+    void command_perf(const Words& parts){
+#ifdef VIMIFIED_PERF
+        auto& log = PerfLog::get();
+        if (parts.size()>=2 && parts[1]=="reset") { log.reset(); status_="perf: timers cleared."; return; }
+        if (parts.size()>=3 && parts[1]=="trace") {
+            std::string path(parts[2]), tmp = path + ".~tmp";
+            bool ok = write_temp_file(tmp, [&](FileWriter& w){ return log.write_trace(w); }) && replace_with_temp(tmp, path);
+            status_ = ok ? "perf: trace -> " + path : "perf: cannot write " + path;
+            return;
+        }
+        report_ = log.summary(); report_title_ = "perf (last " + std::to_string(log.events().size()) + " events)";
+        pane_ = Pane::REPORT; out_visible_ = true;
+        status_ = "perf: timings in the output pane (:out hides it).";
+#else
+        (void)parts;
+        status_ = "perf: this build has no timers (rebuild with -DVIMIFIED_PERF).";
+#endif
     }
 
     // ---- execute :commands ----
-    bool execute_command(const std::string& raw){
-        auto s = trim_copy(raw); if (s.empty()){ status_.clear(); return false; }
-        auto parts = split_ws(s); auto cmd = parts.empty()? std::string() : parts[0];
+    // The line is split into views; only commands that store a name or path copy it.
+    bool execute_command(std::string_view raw){
+        PERF_SCOPE("execute_command");
+        auto s = trim_view(raw); if (s.empty()){ status_.clear(); return false; }
+        // patterns keep their spaces, so these are taken from the raw line
+        if (s[0]=='/') { std::string_view p = raw.substr(raw.find('/') + 1);
+                         if (p.empty()) next_match(true); else start_search(p); return false; }
+        if (s.starts_with("s/") || s.starts_with("%s/")) { command_substitute(raw.substr(raw.find('/') + 1), s[0]=='%'); return false; }
+        Words parts(s); std::string_view cmd = parts[0];
+        if (parts.overflow()) { status_ = "Too many arguments: :" + std::string(s); return false; }
+        bool bad_number = false;
+        auto num = [&](std::size_t i, std::uint64_t dflt){
+            std::uint64_t v = dflt;
+            if (i < parts.size() && !parse_u64(parts[i], v)) bad_number = true;
+            return v;
+        };
 
-        if (cmd=="q"){ if (dirty_) status_="Unsaved changes! Use :q! to force quit."; else return true; }
-        else if (cmd=="q!") return true;
-        else if (cmd=="w"){ std::string path = (parts.size()>=2)? parts[1] : filename_; save_file(path); }
+        if (cmd=="q"){ if (any_dirty()) status_="Unsaved changes! Use :q! to force quit."; else { discard_swaps(); return true; } }
+        else if (cmd=="q!") { discard_swaps(); return true; }
+        else if (cmd=="recover" || cmd=="recover!"){ command_recover(parts[1], cmd=="recover!"); }
+        else if (cmd=="hud"){
+            hud_ = !hud_;
+            if (hud_ && !live_.active()) live_.start();
+            status_ = hud_ ? "HUD on." : "HUD off.";
+        }
+        else if (cmd=="perf"){ command_perf(parts); }
+        else if (cmd=="n" || cmd=="N"){ next_match(cmd=="n"); }
+        else if (cmd=="syntax"){
+            syntax_ = !(parts.size()>=2 && parts[1]=="off");
+            reset_highlight();
+            status_ = !syntax_ ? "syntax: off." : hl_on_ ? "syntax: C++ highlighting on." : "syntax: on for C++ files.";
+        }
+        else if (cmd=="index"){
+            index_on_ = !(parts.size()>=2 && parts[1]=="off");
+            if (!index_on_) trigrams_.clear();
+            status_ = index_on_ ? "index: trigram sets are built by the next search." : "index: off.";
+        }
+        else if (cmd=="u" || cmd=="undo"){ undo(); }
+        else if (cmd=="redo"){ redo(); }
+        else if (cmd=="w"){ save_file(parts.size()>=2 ? std::string(parts[1]) : filename_); }
         else if (cmd=="o"){
             if (parts.size()<2) status_="Usage: :o <filename>";
             else if (dirty_) status_="Unsaved changes! Save with :w first.";
-            else open_file(parts[1]);
+            else open_file(std::string(parts[1]));
+        }
+        else if (cmd=="e"){ if (parts.size()<2) status_="Usage: :e <filename>"; else edit_file(std::string(parts[1])); }
+        else if (cmd=="bn" || cmd=="bp"){
+            if (bufs_.size() < 2) status_="Only one buffer.";
+            else switch_buffer((cur_buf_ + (cmd=="bn" ? 1 : bufs_.size() - 1)) % bufs_.size());
+        }
+        else if (cmd=="ls"){ list_buffers(); }
+        else if (cmd=="budget"){
+            if (std::uint64_t mb = num(1, mem_budget_ >> 20); !bad_number) { mem_budget_ = (std::size_t)mb << 20; enforce_budget(); }
+            if (!bad_number) status_ = "budget: " + std::to_string(mem_budget_ >> 20) + " MB for buffers.";
         }
         else if (cmd=="help"){ show_help(); }
-        else if (cmd=="cpp"){ command_cpp(); }
+        else if (cmd=="kill"){
+            if (job_ && job_->running()) { job_->cancel(); status_="Cancelling…"; }
+            else if (repl_.busy()) { repl_.stop(); status_="REPL killed (next :eval restarts it)."; }
+            else if (cpp_job_) { cpp_job_->cancel(); status_="Cancelling the build…"; }
+            else status_="No command running.";
+        }
+        else if (cmd=="cn" || cmd=="cp"){
+            const auto* e = (cmd=="cn") ? qf_.next() : qf_.prev();
+            if (e) { pane_ = Pane::QUICKFIX; jump_to(*e); }
+            else status_ = qf_.size() ? "No more diagnostics." : "Quickfix list is empty.";
+        }
+        else if (cmd=="repl"){ command_repl(parts); }
+        else if (cmd=="eval"){ command_eval(parts.size()>=2 && parts[1]=="all"); }
+        else if (cmd=="out"){
+            if (parts.size()>=2 && parts[1]=="put"){
+                auto out = trim_copy(shell_out_.text());
+                if (out.empty()) status_="Output buffer is empty.";
+                else { insert_text_block(out); status_="Output inserted."; }
+            } else { out_visible_ = !out_visible_; status_.clear(); }
+        }
+        else if (cmd=="cpp"){
+            if (parts.size()>=3 && parts[1]=="pch"){ cpp_pch_ = (parts[2]=="on"); status_ = std::string("cpp: precompiled header ") + (cpp_pch_? "on" : "off"); }
+            else command_cpp();
+        }
         else if (!cmd.empty() && cmd[0]=='!'){
-            std::string rest = s.substr(1); if (!rest.empty() && rest[0]==' ') rest.erase(0,1); command_shell(rest);
+            auto rest = s.substr(1); if (!rest.empty() && rest[0]==' ') rest.remove_prefix(1); command_shell(std::string(rest));
         }
         else if (cmd=="tok"){
-            if (parts.size()==1) status_="tok: usage -> :tok stats|ngram|export|perm ...";
-            else if (parts[1]=="stats"){ if (parts.size()>=3) tok_stats(parts[2]); else tok_stats(std::nullopt); }
-            else if (parts[1]=="ngram"){ std::size_t N = parts.size()>=3? (std::size_t)std::stoul(parts[2]) : 2;
-                                         std::size_t K = parts.size()>=4? (std::size_t)std::stoul(parts[3]) : 20; tok_ngram(N,K); }
-            else if (parts[1]=="export"){ if (parts.size()<3) status_="tok: export <file.json>"; else tok_export(parts[2]); }
-            else if (parts[1]=="perm"){ if (parts.size()<4) status_="tok: perm <len> <limit>";
-                                        else tok_perm((std::uint64_t)std::stoull(parts[2]), (std::uint64_t)std::stoull(parts[3])); }
+            if (parts.size()==1) status_="tok: usage -> :tok stats|ngram|corpus|export|perm ...";
+            else if (parts[1]=="stats"){ if (parts.size()>=3) tok_stats(std::string(parts[2])); else tok_stats(std::nullopt); }
+            else if (parts[1]=="ngram"){ std::size_t N = (std::size_t)num(2, 2), K = (std::size_t)num(3, 20);
+                                         if (!bad_number) tok_ngram(N,K); }
+            else if (parts[1]=="corpus"){ std::size_t N = (std::size_t)num(3, 1), K = (std::size_t)num(4, 20);
+                                          if (parts.size()<3) status_="tok: corpus <dir|glob> [N [K]]"; else if (!bad_number) tok_corpus(std::string(parts[2]), N, K); }
+            else if (parts[1]=="export"){ if (parts.size()<3) status_="tok: export <file> [json|bin]"; else tok_export(std::string(parts[2]), std::string(parts[3])); }
+            else if (parts[1]=="perm"){
+                if (parts.size()<4) status_="tok: perm <len> <count|all> [file [alphabet [start]]]";
+                else {
+                    std::uint64_t count = parts[3]=="all" ? PermutationStream::ALL : num(3, 0);
+                    std::string_view alpha = parts.size()>=6 ? parts[5] : std::string_view(SAFE_ALPHABET.data(), SAFE_ALPHABET.size());
+                    std::uint64_t len = num(2, 0), start = num(6, 0);
+                    if (!bad_number) tok_perm(len, count, std::string(parts[4]), alpha, start);
+                }
+            }
             else status_="tok: unknown subcommand";
         }
-        else status_="Unknown command: " + cmd;
+        else status_="Unknown command: " + std::string(cmd);
+        if (bad_number) status_ = "Not a number: :" + std::string(s);
         return false;
     }
 
     void show_help(){
-        int rows, cols; get_console_size(rows, cols); clear_screen();
+        int rows, cols; console_size(rows, cols);
+        screen_.resize(rows, cols); screen_.clear();
         std::vector<std::string> lines = {
             "--- vimified (C++23, Windows console) Help ---",
             "",
@@ -541,28 +4266,384 @@ private:
             "  COMMAND: ESC then type ':' commands.",
             "",
             "MOVE (arrows or h/j/k/l), Backspace/Delete, Enter",
+            "UNDO Ctrl+Z / :u, REDO Ctrl+Y / :redo",
             "",
             "COMMANDS",
             "  :w [file]           Save",
             "  :o <file>           Open (warns if unsaved)",
+            "  :e <file>           Edit file in another buffer (unsaved ones stay open)",
+            "  :bn | :bp | :ls     Next / previous buffer, list buffers",
+            "  :budget <MB>        Memory for buffers; unmodified ones get evicted",
             "  :q | :q!            Quit / Force quit",
-            "  :! <cmd>            Run shell and insert output",
-            "  :cpp                Compile & run buffer with g++ -std=c++23",
+            "  :recover [discard]  Replay (or delete) the swap file of a crashed session",
+            "  :! <cmd>            Run shell in the background (output pane)",
+            "  :kill               Cancel the running command, build or REPL eval",
+            "  :out [put]          Toggle output pane / insert output at cursor",
+            "  :cpp                Compile & run buffer with g++ -std=c++23 (cached)",
+            "  :cpp pch on|off     Use a precompiled header for the std library",
+            "  :cn | :cp           Next / previous compiler diagnostic",
+            "  :/pattern           Search (literal or regex: . [] * + ? | () ^ $ \\d \\w \\s)",
+            "  :n | :N             Next / previous match (:/ alone repeats)",
+            "  :s/pat/rep/[g]      Substitute on this line (:%s for all; & is the match)",
+            "  :index [off]        Trigram index to skip chunks in repeated literal searches",
+            "  :syntax [off]       C++ highlighting (on by default for .cpp/.h/... files)",
+            "  :repl [exe] | stop  Start/stop a persistent clang-repl session",
+            "  :eval [all]         Send current line (or buffer) to the REPL",
             "  :tok stats [f]      Token stats (buffer or file)",
+            "  :hud                Toggle live token count / entropy in the status bar",
+            "  :perf [reset]       p50/p99 timings (-DVIMIFIED_PERF builds)",
+            "  :perf trace f.json  Dump recent timings as a Chrome trace",
             "  :tok ngram N [K]    Top-K N-grams (default K=20)",
-            "  :tok export f.json  Save JSON stats for buffer",
+            "  :tok corpus d|glob [N [K]]  Stats and top-K tokens/N-grams over many files (cached)",
+            "  :tok export f [bin] Save stats (JSON, or columnar binary for bin/.bin)",
             "  :tok perm L M       First M permutations length L (alphabet {1,2,3})",
+            "  :tok perm L M|all f [abc [start]]  Stream them to file f (no limit)",
             "",
             "Press any key…"
         };
-        for (int i=0;i<(int)lines.size() && i<rows-1; ++i){ move_cursor(i,2); std::cout << lines[(size_t)i]; }
-        std::cout.flush(); _getch();
+        for (int i=0;i<(int)lines.size() && i<rows-1; ++i) screen_.put(i, 2, lines[(size_t)i]);
+        screen_.present(); input_.get();
     }
 };
 
 // ============ main ============
 
+// --ab-tokenize <file>: run the scanner and the std::regex reference over the
+// same text, check they agree token for token, and print timings as JSON.
+static int ab_tokenize(const char* path){
+    auto s = read_text_file(path);
+    if (!s) { std::cerr << "ab-tokenize: cannot open " << path << "\n"; return 2; }
+    using clock = std::chrono::steady_clock;
+    auto t0 = clock::now(); auto fast = tokenize_words(*s);
+    auto t1 = clock::now(); auto ref  = tokenize_words_regex(*s);
+    auto t2 = clock::now();
+    bool same = fast.size() == ref.size() && std::equal(fast.begin(), fast.end(), ref.begin(),
+                    [](std::string_view a, const std::string& b){ return a == b; });
+    auto ms = [](auto d){ return std::chrono::duration<double, std::milli>(d).count(); };
+    std::cout << "{ \"bytes\": " << s->size() << ", \"tokens\": " << fast.size()
+              << ", \"identical\": " << (same ? "true" : "false")
+              << ", \"scanner_ms\": " << ms(t1 - t0) << ", \"regex_ms\": " << ms(t2 - t1) << " }\n";
+    return same ? 0 : 1;
+}
+
+// --batch "<command>" <file|@list>...: run an analytics command over many
+// files with no console, one JSON object per input on stdout (JSON Lines,
+// in input order). Files are processed concurrently on the worker pool;
+// each one is mapped rather than read where possible.
+//   tok stats                       scalar token stats
+//   tok ngram N [K]                 top-K N-grams
+//   tok export <dir> [json|bin]     <dir>/<name>.<json|bin> per input
+static int batch_cli(int argc, char** argv){
+    if (argc < 4) { std::cerr << "usage: --batch \"tok stats|tok ngram N [K]|tok export <dir> [json|bin]\" <file|@list>...\n"; return 2; }
+    Words cmd(argv[2]);
+    if (cmd.overflow()) { std::cerr << "batch: too many words in the command\n"; return 2; }
+    enum { STATS, NGRAM, EXPORT } kind;
+    std::size_t N = 2, K = 20;
+    std::string outdir, format = "json";
+    if (cmd.size() >= 2 && cmd[0] == "tok" && cmd[1] == "stats") kind = STATS;
+    else if (cmd.size() >= 2 && cmd[0] == "tok" && cmd[1] == "ngram") {
+        kind = NGRAM;
+        std::uint64_t v;
+        if (cmd.size() >= 3) N = parse_u64(cmd[2], v) ? (std::size_t)v : 0;
+        if (cmd.size() >= 4) K = parse_u64(cmd[3], v) ? (std::size_t)v : 0;
+        if (!N) { std::cerr << "batch: N must be >=1\n"; return 2; }
+    }
+    else if (cmd.size() >= 3 && cmd[0] == "tok" && cmd[1] == "export") {
+        kind = EXPORT; outdir = cmd[2];
+        if (cmd.size() >= 4) format = cmd[3];
+        if (format != "json" && format != "bin") { std::cerr << "batch: export format is json or bin\n"; return 2; }
+    }
+    else { std::cerr << "batch: unsupported command: " << argv[2] << "\n"; return 2; }
+
+    std::vector<std::string> files;
+    for (int i = 3; i < argc; ++i) {
+        if (argv[i][0] != '@') { files.emplace_back(argv[i]); continue; }
+        auto list = read_text_file(argv[i] + 1);
+        if (!list) { std::cerr << "batch: cannot read " << (argv[i] + 1) << "\n"; return 2; }
+        std::istringstream in(*list);
+        for (std::string l; std::getline(in, l);) if (auto t = trim_copy(l); !t.empty()) files.push_back(std::move(t));
+    }
+
+    // results are printed in input order as soon as every earlier one is done
+    FileWriter out;
+    if (!out.open("-")) return 2;
+    std::vector<std::optional<std::string>> done(files.size());
+    std::size_t next_out = 0;
+    std::mutex out_mu;
+    std::atomic<bool> failed{false};
+    parallel_for(files.size(), [&](std::size_t i){
+        const std::string& path = files[i];
+        StringSink js;
+        js.write("{\"file\": "); json_write_string(js, path);
+        MappedFile mf; std::string owned; std::string_view text;
+        bool opened = true;
+        if (mf.open(path)) text = mf.view();
+        else if (auto s = read_text_file(path)) { owned = std::move(*s); text = owned; }
+        else opened = false;
+        if (!opened) { js.write(", \"error\": \"cannot open\""); failed = true; }
+        else if (kind == NGRAM) {
+            TokenInterner in;
+            auto ids = intern_words(text, in);
+            js.write(", \"n\": "); json_write_number(js, (std::uint64_t)N);
+            js.write(", \"top\": [");
+            bool first = true;
+            for (auto& [ng, cnt] : top_ngrams(ids, in, N, K)) {
+                js.write(first ? "{\"gram\": [" : ", {\"gram\": ["); first = false;
+                for (std::size_t k = 0; k < ng.size(); ++k) { if (k) js.write(", "); json_write_string(js, ng[k]); }
+                js.write("], \"count\": "); json_write_number(js, (std::uint64_t)cnt); js.write("}");
+            }
+            js.write("]");
+        } else {
+            // one file per worker already fills the pool; only a lone input goes parallel inside
+            TokenStats st;
+            if (files.size() == 1) st = compute_token_stats(text);
+            else { accumulate_token_stats(st, text); finish_token_stats(st); }
+            if (kind == STATS) json_write_stats_fields(js, st, ", ");
+            else {
+                std::string name = path.substr(path.find_last_of("/\\") == std::string::npos ? 0 : path.find_last_of("/\\") + 1);
+                bool sep = !outdir.empty() && (outdir.back() == '\\' || outdir.back() == '/');
+                std::string dest = outdir + (sep ? "" : "\\") + name + "." + format, tmp = dest + ".~tmp";
+                bool ok = write_temp_file(tmp, [&](FileWriter& w){
+                    return format == "bin" ? write_token_stats_bin(w, st) : write_token_stats_json(w, st, path);
+                }) && replace_with_temp(tmp, dest);
+                js.write(", \"export\": "); json_write_string(js, dest);
+                if (!ok) { js.write(", \"error\": \"write failed\""); failed = true; }
+            }
+        }
+        js.write("}\n");
+        std::lock_guard lock(out_mu);
+        done[i] = std::move(js.out);
+        for (; next_out < done.size() && done[next_out]; ++next_out) { out.write(*done[next_out]); done[next_out].reset(); }
+        out.flush();
+    });
+    out.close();
+    return failed ? 1 : 0;
+}
+
+// --perm <len> <count|all> <file|-> [alphabet] [start]: stream the sequence
+// without starting the editor; start offsets split one run across processes.
+static int perm_cli(int argc, char** argv){
+    std::uint64_t len = 0, count = PermutationStream::ALL, start = 0;
+    bool args_ok = argc >= 5 && argc <= 7
+                && parse_u64(argv[2], len) && len >= 1 && len <= PermutationStream::MAX_LEN
+                && (std::string_view(argv[3]) == "all" || parse_u64(argv[3], count))
+                && (argc < 7 || parse_u64(argv[6], start));
+    if (!args_ok) {
+        std::cerr << "usage: --perm <len> <count|all> <file|-> [alphabet] [start]\n"
+                     "  len is 1.." << PermutationStream::MAX_LEN << "; count and start are decimal\n";
+        return 2;
+    }
+    std::string_view alpha = argc >= 6 ? std::string_view(argv[5]) : std::string_view(SAFE_ALPHABET.data(), SAFE_ALPHABET.size());
+    PermutationStream ps(alpha, (std::size_t)len, start, count);
+    FileWriter w;
+    bool ok = w.open(argv[4]) && stream_permutations(w, ps);
+    ok = w.close() && ok;
+    if (!ok) std::cerr << "perm: cannot write " << argv[4] << "\n";
+    return ok ? 0 : 1;
+}
+
+#ifdef VIMIFIED_BENCH
+// ============ benchmarks ============
+// One JSON object per measurement on stdout. Each case repeats until it
+// has run for a second (at least once, at most 5 times); min and median
+// wall time are reported, with throughput against the corpus size, and
+// the fewest heap allocations one run made. The exit status is 1 when a
+// steady-state keystroke or frame allocated.
+
+// a bench build counts every operator new
+static std::atomic<std::size_t> g_bench_allocs{0};
+void* operator new(std::size_t n){
+    g_bench_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+// kept out of line: inlined, GCC pairs operator new with a bare free()
+// and warns of a mismatch (-Wmismatched-new-delete)
+[[gnu::noinline]] void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { operator delete(p); }
+
+static volatile std::size_t g_bench_sink;
+
+struct EditorBench {
+    static std::size_t open(Editor& e, const std::string& path){ e.open_file(path); e.buffer_->ensure_indexed(); return e.buffer_->line_count(); }
+    static bool save(Editor& e, const std::string& path){ e.save_file(path); return !e.dirty_; }
+    // one input batch of pasted text, as edit_loop hands it over
+    static std::size_t paste(Editor& e, std::string_view keys){ e.type_text(keys); return e.buffer_->size(); }
+    // type the text: printable bytes and tabs through insert_char, '\n' as
+    // Enter, a Backspace every 97 keys, and a pasted block every 4 KiB
+    static std::size_t replay(Editor& e, std::string_view keys){
+        std::size_t n = 0;
+        for (std::size_t i = 0; i < keys.size(); ++i, ++n) {
+            char c = keys[i];
+            if (c == '\n') e.newline();
+            else if (c != '\r') e.insert_char(c);
+            if (i % 97 == 96) e.backspace();
+            if (i % 4096 == 4095) e.insert_text_block(keys.substr(i + 1 - 256, 256));
+        }
+        return n + e.buffer_->size();
+    }
+    // Typing as edit_loop does it: an idle tick before each key, and the
+    // frame after it rendered (not written out). Returns the heap
+    // allocations the keys and frames made; the idle ticks are not counted.
+    static std::size_t steady(Editor& e, std::string_view keys){
+        std::size_t allocs = 0;
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            e.idle_tick();
+            std::size_t a0 = g_bench_allocs.load(std::memory_order_relaxed);
+            char c = keys[i];
+            if (c == '\n') e.newline();
+            else if (c != '\r') e.insert_char(c);
+            if (i % 97 == 96) e.backspace();
+            e.ensure_visible(); e.compose();
+            g_bench_sink = g_bench_sink + e.screen_.render().size();
+            allocs += g_bench_allocs.load(std::memory_order_relaxed) - a0;
+        }
+        return allocs;
+    }
+};
+
+template <class F>
+static void bench(const char* name, const std::string& corpus, std::size_t bytes, F&& body){
+    using clock = std::chrono::steady_clock;
+    std::vector<double> ms;
+    ms.reserve(5);
+    double total = 0;
+    std::size_t allocs = std::numeric_limits<std::size_t>::max();
+    while (ms.empty() || (total < 1000.0 && ms.size() < 5)) {
+        std::size_t a0 = g_bench_allocs.load(std::memory_order_relaxed);
+        auto t0 = clock::now();
+        g_bench_sink = g_bench_sink + body();
+        ms.push_back(std::chrono::duration<double, std::milli>(clock::now() - t0).count());
+        allocs = std::min(allocs, g_bench_allocs.load(std::memory_order_relaxed) - a0);
+        total += ms.back();
+    }
+    std::sort(ms.begin(), ms.end());
+    std::printf("{\"bench\": \"%s\", \"corpus\": \"%s\", \"bytes\": %zu, \"iters\": %zu, \"ms_min\": %.3f, \"ms_median\": %.3f, \"mb_per_s\": %.1f, \"allocs\": %zu}\n",
+                name, json_escape(corpus).c_str(), bytes, ms.size(), ms.front(), ms[ms.size() / 2],
+                ms.front() > 0 ? double(bytes) / 1e3 / ms.front() : 0.0, allocs);
+    std::fflush(stdout);
+}
+
+// Zipf-ish words from a fixed vocabulary, ~60-byte lines; deterministic.
+static std::string synthetic_corpus(std::size_t bytes){
+    std::mt19937_64 rng(42);
+    std::vector<std::string> vocab;
+    for (int i = 0; i < 50000; ++i) {
+        std::string w;
+        for (std::size_t k = 0, len = 2 + rng() % 9; k < len; ++k) w.push_back("etaoinshrdlucmfwypvbgkqjxz_0123456789"[rng() % (i < 1000 ? 26 : 37)]);
+        vocab.push_back(std::move(w));
+    }
+    std::string out;
+    out.reserve(bytes + 64);
+    std::size_t col = 0;
+    while (out.size() < bytes) {
+        double u = double(rng() >> 11) / double(1ull << 53);
+        const std::string& w = vocab[std::min<std::size_t>(vocab.size() - 1, std::size_t(std::pow(double(vocab.size()), u * u)))];
+        out += w; col += w.size();
+        if (col > 60) { out += '\n'; col = 0; } else out += (rng() % 8 ? ' ' : ',');
+    }
+    out.resize(bytes);
+    return out;
+}
+
+static std::size_t parse_size(std::string_view s){
+    std::size_t v = std::strtoull(std::string(s).c_str(), nullptr, 10);
+    switch (s.empty() ? 0 : s.back()) { case 'K': return v << 10; case 'M': return v << 20; case 'G': return v << 30; default: return v; }
+}
+
+// false when a steady-state keystroke allocated
+static bool bench_corpus(const std::string& label, const std::string& text, const std::string& tmpdir){
+    const std::size_t n = text.size();
+    bool ok = true;
+    bench("tokenize_words", label, n, [&]{ return tokenize_words(text).size(); });
+    bench("compute_token_stats", label, n, [&]{ return compute_token_stats(text).tokens; });
+    TokenInterner in;
+    auto ids = intern_words(text, in);
+    bench("intern_words", label, n, [&]{ TokenInterner t; return intern_words(text, t).size(); });
+    for (std::size_t N = 1; N <= 5; ++N) {
+        std::string name = "top_ngrams_n" + std::to_string(N);
+        bench(name.c_str(), label, n, [&]{ return top_ngrams(ids, in, N, 20).size(); });
+    }
+    for (const char* pat : {"zq", "int [a-z]+\\("}) {
+        SearchPattern sp; std::string err; sp.compile(pat, err);
+        bench(sp.literal() ? "search_literal" : "search_regex", label, n, [&]{ SearchPattern::Scratch sc; std::vector<SearchPattern::Match> m; search_unit(sp, 0, text, sc, m); return m.size(); });
+    }
+    std::string path = tmpdir + "vimified_bench.txt", copy = tmpdir + "vimified_bench_save.txt";
+    if (!write_text_file(path, text)) { std::fprintf(stderr, "bench: cannot write %s\n", path.c_str()); return false; }
+    bench("open_file", label, n, [&]{ Editor e(nullptr, false); return EditorBench::open(e, path); });
+    {
+        Editor e(nullptr, false); EditorBench::open(e, path);
+        bench("save_file", label, n, [&]{ return (std::size_t)EditorBench::save(e, copy); });
+    }
+    std::string_view keys = std::string_view(text).substr(0, std::min<std::size_t>(n, std::size_t(8) << 20));
+    bench("keystroke_replay", label, keys.size(), [&]{ Editor e(nullptr, false); return EditorBench::replay(e, keys); });
+    bench("paste_batch", label, keys.size(), [&]{ Editor e(nullptr, false); return EditorBench::paste(e, keys); });
+    {
+        // the same typing into an editor that has already warmed up, with
+        // the idle ticks and frames in between: none of it may allocate
+        // (bytes = keys typed)
+        std::string_view some = keys.substr(0, std::size_t(64) << 10);
+        Editor e(nullptr, false); EditorBench::steady(e, some);
+        std::size_t worst = 0;
+        bench("keystroke_steady", label, some.size(), [&]{
+            std::size_t a = EditorBench::steady(e, some);
+            worst = std::max(worst, a);
+            return a;
+        });
+        if (worst) {
+            std::fprintf(stderr, "bench: %zu heap allocations in %zu steady-state keystrokes and frames (%s)\n", worst, some.size(), label.c_str());
+            ok = false;
+        }
+    }
+    DeleteFileA(path.c_str()); DeleteFileA(copy.c_str());
+    return ok;
+}
+
+static int bench_main(int argc, char** argv){
+    std::vector<std::size_t> sizes{std::size_t(1) << 20, std::size_t(100) << 20};
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view a = argv[i];
+        if (a == "--sizes" && i + 1 < argc) {
+            sizes.clear();
+            std::string_view l = argv[++i];
+            for (std::size_t p = 0; p <= l.size();) {
+                std::size_t q = std::min(l.find(',', p), l.size());
+                if (q > p) sizes.push_back(parse_size(l.substr(p, q - p)));
+                p = q + 1;
+            }
+        } else files.emplace_back(a);
+    }
+    char tmp[MAX_PATH]; GetTempPathA(MAX_PATH, tmp);
+    bool ok = true;
+    for (std::size_t sz : sizes) {
+        std::string text = synthetic_corpus(sz);
+        ok = bench_corpus("synthetic", text, tmp) && ok;
+        // permutations need no corpus; emit as many bytes as it holds
+        bench("compose_permutations", "base3", sz, [&]{
+            PermutationStream ps("123", 12);
+            std::string block(2 * FileWriter::BUFFER_BYTES, '\0');
+            std::size_t done = 0;
+            while (done < sz && ps.remaining()) done += ps.fill(block.data(), std::min(block.size(), sz - done + ps.line_width()));
+            return done;
+        });
+    }
+    for (auto& f : files) {
+        auto text = read_text_file(f);
+        if (!text) { std::fprintf(stderr, "bench: cannot open %s\n", f.c_str()); continue; }
+        ok = bench_corpus(f, *text, tmp) && ok;
+    }
+    return ok ? 0 : 1;
+}
+#endif
+
 int main(int argc, char** argv){
+#ifdef VIMIFIED_BENCH
+    return bench_main(argc, argv);
+#endif
+    if (argc >= 3 && std::string_view(argv[1]) == "--ab-tokenize") return ab_tokenize(argv[2]);
+    if (argc >= 2 && std::string_view(argv[1]) == "--perm") return perm_cli(argc, argv);
+    if (argc >= 2 && std::string_view(argv[1]) == "--batch") return batch_cli(argc, argv);
     const char* initial = (argc>=2)? argv[1] : nullptr;
     Editor ed(initial);
     return ed.run();